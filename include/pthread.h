@@ -87,7 +87,12 @@ extern "C" {
 #define _POSIX_THREAD_PRIORITY_SCHEDULING -1
 
 #undef _POSIX_THREAD_PROCESS_SHARED
+#ifdef LIBPTHREAD_INLINE_MUTEX
+/* Only mutexes can be shared, and only with the inline mutex ABI. */
+#define _POSIX_THREAD_PROCESS_SHARED 200809L
+#else
 #define _POSIX_THREAD_PROCESS_SHARED -1
+#endif
 
 /* POSIX Thread Definitions */
 #define PTHREAD_KEYS_MAX            1024
@@ -119,14 +124,33 @@ extern "C" {
 #define PTHREAD_MUTEX_NORMAL        0
 #define PTHREAD_MUTEX_RECURSIVE     1
 #define PTHREAD_MUTEX_ERRORCHECK    2
+#define PTHREAD_MUTEX_ADAPTIVE_NP   3
+#define PTHREAD_MUTEX_HANDOFF_NP    4
 #define PTHREAD_MUTEX_DEFAULT       PTHREAD_MUTEX_NORMAL
 
+/* How barrier waiters wait, as OMP_WAIT_POLICY */
+#define PTHREAD_WAIT_POLICY_DEFAULT_NP  0 /* spin briefly, then block */
+#define PTHREAD_WAIT_POLICY_PASSIVE_NP  1 /* block at once */
+#define PTHREAD_WAIT_POLICY_ACTIVE_NP   2 /* spin much longer before blocking */
+
+/* How barrier arrivals are counted */
+#define PTHREAD_BARRIER_DEFAULT_NP      0 /* tree from 16 threads on */
+#define PTHREAD_BARRIER_FLAT_NP         1 /* one shared counter */
+#define PTHREAD_BARRIER_TREE_NP         2 /* topology-ordered combining tree */
+
+/* Reductions of pthread_barrier_reduce_np() */
+#define PTHREAD_REDUCE_SUM_NP           0
+#define PTHREAD_REDUCE_MIN_NP           1
+#define PTHREAD_REDUCE_MAX_NP           2
+#define PTHREAD_REDUCE_CUSTOM_NP        3
+
 #define PTHREAD_MUTEX_STALLED       0
 #define PTHREAD_MUTEX_ROBUST        1
 
 #define PTHREAD_SPINLOCK_INITIALIZER    {0, 0}
 #define PTHREAD_SPIN_RWLOCK_INITIALIZER {0, 0, 0}
-#define PTHREAD_MUTEX_INITIALIZER       NULL
+#define PTHREAD_SEQLOCK_INITIALIZER     {0, PTHREAD_SPINLOCK_INITIALIZER}
+#define PTHREAD_MCS_LOCK_INITIALIZER    {NULL, NULL}
 #define PTHREAD_RWLOCK_INITIALIZER      NULL
 #define PTHREAD_COND_INITIALIZER        NULL
 
@@ -143,10 +167,57 @@ typedef void    *pthread_condattr_t;
 typedef void    *pthread_rwlockattr_t;
 typedef void    *pthread_barrierattr_t;
 
+#ifdef LIBPTHREAD_INLINE_MUTEX
+/*
+ * Inline mutex ABI: the lock word lives in the caller's own storage and
+ * static mutexes need no heap allocation on first use. The library and
+ * every application must be built with the same LIBPTHREAD_INLINE_MUTEX
+ * setting. The size is fixed at 64 bytes on 64-bit Windows.
+ */
+typedef struct {
+    long __lock;
+    long __data[11];
+    void *__ptr[2];
+} pthread_mutex_t;
+#define PTHREAD_MUTEX_INITIALIZER       {0, {0}, {NULL, NULL}}
+#else
 typedef void    *pthread_mutex_t;
+#define PTHREAD_MUTEX_INITIALIZER       NULL
+#endif
+
+#define PTHREAD_LOCKSTAT_NAME_MAX       32
+
+/* Contention statistics of one mutex, see pthread_lockstat_snapshot_np(). */
+typedef struct {
+    const pthread_mutex_t *mutex;
+    char name[PTHREAD_LOCKSTAT_NAME_MAX];
+    int type;
+    long spin_count; /* current spin budget */
+    uint64_t acquisitions;
+    uint64_t trylock_failures;
+    uint64_t timeouts;
+    uint64_t spin_acquisitions; /* contended, acquired without sleeping */
+    uint64_t kernel_waits;
+    uint64_t polled_waits; /* kernel waits that polled, with no wait object */
+    uint64_t wait_cycles; /* total time spent acquiring when contended */
+    uint64_t max_wait_cycles;
+    uint64_t hold_cycles;
+} pthread_lockstat_np_t;
+
+/* Memory footprint of the internal objects, see pthread_memstat_np(). */
+typedef struct {
+    size_t reserved; /* bytes obtained from the system */
+    size_t in_use; /* bytes in live objects */
+    size_t cached; /* bytes of free objects kept for reuse */
+} pthread_memstat_np_t;
+
 typedef void    *pthread_cond_t;
 typedef void    *pthread_rwlock_t;
 typedef void    *pthread_barrier_t;
+typedef void    *pthread_phaser_t;
+
+/* Reduction for PTHREAD_REDUCE_CUSTOM_NP, associative and commutative. */
+typedef int64_t (*pthread_reduce_fn_np)(int64_t a, int64_t b);
 
 typedef struct {
     long owner;
@@ -159,6 +230,18 @@ typedef struct {
     long readers;
 } pthread_spin_rwlock_t;
 
+/* Sequence lock, readers never write to it. */
+typedef struct {
+    long sequence;
+    pthread_spinlock_t lock;
+} pthread_seqlock_t;
+
+/* MCS queue lock, each waiter spins on its own queue node. */
+typedef struct {
+    void *tail;
+    void *owner;
+} pthread_mcs_lock_t;
+
 /*
     #include <signal.h>
     int pthread_sigmask(int how, const sigset_t *set, sigset_t *old_set);
@@ -167,6 +250,7 @@ typedef struct {
 int pthread_atfork(void (*prepare)(void), void (*parent)(void), void (*child)(void));
 int pthread_getconcurrency(void);
 int pthread_setconcurrency(int new_level);
+int pthread_memstat_np(pthread_memstat_np_t *st);
 
 int pthread_attr_init(pthread_attr_t *attr);
 int pthread_attr_getdetachstate(const pthread_attr_t *attr, int *flag);
@@ -224,8 +308,25 @@ int pthread_spin_rwlock_reader_lock(pthread_spin_rwlock_t *lock);
 int pthread_spin_rwlock_reader_unlock(pthread_spin_rwlock_t *lock);
 int pthread_spin_rwlock_writer_lock(pthread_spin_rwlock_t *lock);
 int pthread_spin_rwlock_writer_unlock(pthread_spin_rwlock_t *lock);
+int pthread_spin_rwlock_upgradable_lock(pthread_spin_rwlock_t *lock);
+int pthread_spin_rwlock_upgradable_unlock(pthread_spin_rwlock_t *lock);
+int pthread_spin_rwlock_upgrade(pthread_spin_rwlock_t *lock);
+int pthread_spin_rwlock_downgrade(pthread_spin_rwlock_t *lock);
 int pthread_spin_rwlock_destroy(pthread_spin_rwlock_t *lock);
 
+int pthread_seqlock_init(pthread_seqlock_t *lock, int pshared);
+long pthread_seqlock_read_begin(pthread_seqlock_t *lock);
+int pthread_seqlock_read_validate(pthread_seqlock_t *lock, long stamp);
+int pthread_seqlock_write_lock(pthread_seqlock_t *lock);
+int pthread_seqlock_write_unlock(pthread_seqlock_t *lock);
+int pthread_seqlock_destroy(pthread_seqlock_t *lock);
+
+int pthread_mcs_init(pthread_mcs_lock_t *lock, int pshared);
+int pthread_mcs_lock(pthread_mcs_lock_t *lock);
+int pthread_mcs_trylock(pthread_mcs_lock_t *lock);
+int pthread_mcs_unlock(pthread_mcs_lock_t *lock);
+int pthread_mcs_destroy(pthread_mcs_lock_t *lock);
+
 int pthread_mutexattr_init(pthread_mutexattr_t *attr);
 int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *attr, int *prioceiling);
 int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *attr, int prioceiling);
@@ -249,15 +350,35 @@ int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *abs_t
 int pthread_mutex_unlock(pthread_mutex_t *mutex);
 int pthread_mutex_destroy(pthread_mutex_t *mutex);
 
+int pthread_mutex_setname_np(pthread_mutex_t *mutex, const char *name);
+int pthread_lockstat_snapshot_np(pthread_lockstat_np_t *buf, int count, int *total);
+
 int pthread_barrierattr_init(pthread_barrierattr_t *attr);
 int pthread_barrierattr_getpshared(const pthread_barrierattr_t *attr, int *s);
 int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int s);
+int pthread_barrierattr_getwaitpolicy_np(const pthread_barrierattr_t *attr, int *policy);
+int pthread_barrierattr_setwaitpolicy_np(pthread_barrierattr_t *attr, int policy);
+int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *attr, int *type);
+int pthread_barrierattr_settype_np(pthread_barrierattr_t *attr, int type);
 int pthread_barrierattr_destroy(pthread_barrierattr_t *attr);
 
 int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count);
 int pthread_barrier_wait(pthread_barrier_t *barrier);
+int pthread_barrier_arrive_np(pthread_barrier_t *barrier, long *token);
+int pthread_barrier_wait_token_np(pthread_barrier_t *barrier, long token);
+int pthread_barrier_reduce_np(pthread_barrier_t *barrier, int64_t value, int op,
+    pthread_reduce_fn_np fn, int64_t *result);
 int pthread_barrier_destroy(pthread_barrier_t *barrier);
 
+int pthread_phaser_init(pthread_phaser_t *phaser, const pthread_barrierattr_t *attr, unsigned int parties);
+int pthread_phaser_register(pthread_phaser_t *phaser, unsigned int parties, long *phase);
+int pthread_phaser_deregister(pthread_phaser_t *phaser, long phase);
+int pthread_phaser_arrive(pthread_phaser_t *phaser, long *phase);
+int pthread_phaser_arrive_and_deregister(pthread_phaser_t *phaser, long *phase);
+int pthread_phaser_arrive_and_wait(pthread_phaser_t *phaser, long *phase);
+int pthread_phaser_await(pthread_phaser_t *phaser, long phase);
+int pthread_phaser_destroy(pthread_phaser_t *phaser);
+
 int pthread_condattr_init(pthread_condattr_t *attr);
 int pthread_condattr_getclock(const pthread_condattr_t *attr, clockid_t *clock_id);
 int pthread_condattr_setclock(pthread_condattr_t *attr, clockid_t clock_id);
@@ -49,10 +49,12 @@
         typedef signed char int8_t;
         typedef short int16_t;
         typedef int int32_t;
+        typedef __int64 int64_t;
 
         typedef unsigned char uint8_t;
         typedef unsigned short uint16_t;
         typedef unsigned int uint32_t;
+        typedef unsigned __int64 uint64_t;
 
         #define INT8_MAX        0x7f
         #define UINT8_MAX       0xff
@@ -64,6 +64,9 @@ int sem_post(sem_t *sem);
 int sem_getvalue(sem_t *sem, int *value);
 int sem_destroy(sem_t *sem);
 
+int sem_post_multiple_np(sem_t *sem, int count);
+int sem_wait_multiple_np(sem_t *sem, int max, int *got);
+
 sem_t *sem_open(const char *name, int oflag, mode_t mode, unsigned int value);
 int sem_close(sem_t *sem);
 int sem_unlink(const char *name);
@@ -34,11 +34,42 @@
 #include <winsock2.h>
 #include <pthread.h>
 
+/*
+ * The count of a private semaphore lives in the semaphore itself, and that
+ * of a named one in a section mapped by every process that opens it, so an
+ * uncontended sem_post()/sem_wait() pair makes no system call. Waiters on a
+ * private semaphore sleep on value through the address-wait backend, those
+ * on a named one on a kernel semaphore. Unnamed shared ones are kernel ones.
+ */
 typedef struct
 {
-    HANDLE handle;
+    long value; /* units available */
+    long waiters; /* threads blocked, or about to block, on value */
+    long ready; /* named only, set once value holds the initial value */
+} arch_sem_count;
+
+typedef struct
+{
+    arch_sem_count *count; /* &local, the mapped count, or NULL if kernel */
+    arch_sem_count local;
+    HANDLE handle; /* the kernel semaphore, or the one named waiters sleep on */
+    HANDLE mapping; /* named only, the section holding count */
+    HANDLE name; /* named only, the section holding arch_sem_name */
 } arch_sem_t;
 
+/*
+ * The name of a named semaphore: bit 0 is set while it is linked, and the
+ * upper bits count the sem_unlink() calls, which picks the section of the
+ * count, so a semaphore created after an unlink is a new one.
+ */
+#define ARCH_SEM_LINKED     1
+#define ARCH_SEM_GENERATION 2
+
+typedef struct
+{
+    long state;
+} arch_sem_name;
+
 struct arch_thread_cleanup_node {
     void (* cleaner)(void *);
     void *arg;
@@ -89,7 +120,8 @@ typedef struct {
 
     /*
      * PTHREAD_MUTEX_NORMAL, PTHREAD_MUTEX_ERRORCHECK,
-     * PTHREAD_MUTEX_RECURSIVE, or PTHREAD_MUTEX_DEFAULT
+     * PTHREAD_MUTEX_RECURSIVE, PTHREAD_MUTEX_ADAPTIVE_NP,
+     * PTHREAD_MUTEX_HANDOFF_NP or PTHREAD_MUTEX_DEFAULT
      */
     int type;
 
@@ -103,42 +135,240 @@ typedef struct {
     int prioceiling;
 } arch_mutex_attr;
 
-typedef struct {
-    long wait;
-    long lock_status; /* 0:unlocked, 1:locked */
-    /* long thread_id; debug only */
-    long spin_count;
-    HANDLE sync;
+/*
+ * Mutex lock word: bit 0 is the lock, bit 1 is set while a woken waiter
+ * has not yet run, so at most one wakeup is in flight, and the remaining
+ * bits count the threads sleeping on the word.
+ *
+ * PTHREAD_MUTEX_HANDOFF_NP mutexes also use bit 2, set by a waiter that
+ * has been starved, after which unlock keeps the lock held and sets bit 3
+ * to pass ownership straight to a woken waiter.
+ */
+#define ARCH_MUTEX_LOCKED   1
+#define ARCH_MUTEX_WAKING   2
+#define ARCH_MUTEX_STARVING 4
+#define ARCH_MUTEX_HANDOFF  8
+#define ARCH_MUTEX_WAITER   16
+
+/* Set in arch_mutex.shared_serial if the wait semaphore is in the session namespace. */
+#define ARCH_MUTEX_SHARED_LOCAL 1
+
+/*
+ * arch_mutex.morph, guarded by morph_lock: bits 0-7 count the wakeups that
+ * went to requeued condition waiters in a row, and the upper bits count
+ * the waiters on the morph list. After ARCH_MUTEX_MORPH_BURST of them in a
+ * row, a sleeper on the lock word is woken instead, if there is one.
+ */
+#define ARCH_MUTEX_MORPH_RUN    0xff
+#define ARCH_MUTEX_MORPH_NODE   0x100
+#define ARCH_MUTEX_MORPH_BURST  4
+
+#ifdef LIBPTHREAD_LOCKSTAT
+typedef struct arch_mutex_stat {
+    struct arch_mutex_stat *next, *prev;
+    pthread_mutex_t *mutex;
+    struct arch_mutex *pv;
+    char name[PTHREAD_LOCKSTAT_NAME_MAX];
+    long trylock_failures; /* interlocked, updated without the mutex */
+    long timeouts; /* interlocked, updated without the mutex */
+    long polled_waits; /* interlocked, updated without the mutex */
+    unsigned __int64 acquisitions;
+    unsigned __int64 spin_acquisitions;
+    unsigned __int64 kernel_waits;
+    unsigned __int64 wait_cycles;
+    unsigned __int64 max_wait_cycles;
+    unsigned __int64 hold_cycles;
+    unsigned __int64 acquired_at;
+} arch_mutex_stat;
+#endif
+
+/*
+ * A thread blocked in pthread_cond_wait(). It sleeps on its own state word,
+ * so signal and broadcast can move it to the mutex without waking it.
+ */
+#define ARCH_COND_WAITING   0 /* queued on the condition variable */
+#define ARCH_COND_SIGNALED  1 /* must take the mutex from scratch */
+#define ARCH_COND_MORPHED   2 /* queued on the mutex, counted as its waiter */
+#define ARCH_COND_WOKEN     3 /* picked by an unlock, still counted */
+
+typedef struct arch_cond_waiter {
+    struct arch_cond_waiter *next, *prev;
+    struct arch_mutex *mutex;
+    long state;
+} arch_cond_waiter;
+
+typedef struct arch_mutex {
+    long lock_status; /* ARCH_MUTEX_* flags | waiters */
+    long spin_count; /* learned spin budget for PTHREAD_MUTEX_ADAPTIVE_NP */
+    long type;
+    long owner; /* thread id, RECURSIVE and ERRORCHECK only */
+    long count; /* recursion depth beyond the first lock */
+    long shared_pid; /* PTHREAD_PROCESS_SHARED only, with shared_serial */
+    long shared_serial; /* names the semaphore to block on, 0 if private */
+    pthread_spinlock_t morph_lock;
+    long morph; /* ARCH_MUTEX_MORPH_* */
+    arch_cond_waiter *morph_head, *morph_tail; /* woken before lock word sleepers, in bursts */
+#ifdef LIBPTHREAD_LOCKSTAT
+    arch_mutex_stat *stat;
+#endif
 } arch_mutex;
 
+#ifdef LIBPTHREAD_INLINE_MUTEX
+/* arch_mutex is stored in place of the public pthread_mutex_t. */
+typedef char arch_mutex_fits_inline[sizeof(arch_mutex) <= sizeof(pthread_mutex_t) ? 1 : -1];
+#endif
+
+/* Set in pthread_spin_rwlock_t.readers while a writer holds the lock. */
+#define ARCH_SPIN_RWLOCK_WRITER 0x40000000
+
+/* One per waiter, alone on its cache line, which is all it spins on. */
+typedef struct arch_mcs_node {
+    struct arch_mcs_node * volatile next;
+    long locked;
+} arch_mcs_node;
+
 typedef struct {
     int pshared;
+    int wait_policy; /* PTHREAD_WAIT_POLICY_*_NP */
+    int type; /* PTHREAD_BARRIER_*_NP */
 } arch_barrier_attr;
 
+/*
+ * A combining tree node. A thread arrives at a leaf, and the thread that
+ * fills a node arrives at its parent, so no line sees more than fan-in
+ * arrivals per phase. Leaves come first, then each level up to the root.
+ * A flat barrier is a single node taking every thread.
+ */
+typedef struct {
+    long count; /* arrivals in this phase, may overshoot capacity at leaves */
+    long capacity;
+    long parent; /* -1 at the root */
+    long slots; /* our first value slot, one per arrival */
+    long slot; /* our value slot at the parent */
+    char pad[64 - 5 * sizeof(long)];
+} arch_barrier_node;
+
+/* A value given to pthread_barrier_reduce_np(), stamped with its phase. */
+typedef struct {
+    int64_t value;
+    long stamp; /* epoch + 1 of the phase the value was given for */
+} arch_barrier_slot;
+
+/*
+ * The last thread to arrive resets the nodes and then bumps epoch, which
+ * the others spin on, then sleep on, until it moves past the value they
+ * read before arriving.
+ */
 typedef struct {
-    long count;
     long total;
-    long index;
-    HANDLE semaphore[2];
+    long epoch;
+    long sleepers; /* set while a thread may be blocked on epoch */
+    long leaving; /* threads released but yet to leave the barrier */
+    unsigned __int64 spin; /* arch_cycles() to spin before blocking */
+    arch_barrier_node *tree;
+    arch_barrier_slot *slots;
+    long nodes;
+    long leaves;
+    int64_t result; /* of the last reduction */
 } arch_barrier;
 
+/*
+ * Phaser state word: bits 0-15 count the parties yet to arrive in this
+ * phase, bits 16-31 the registered parties and bits 32-63 the phase, so
+ * registration, arrival and the advance are each a single 64-bit CAS.
+ */
+#define ARCH_PHASER_UNARRIVED   INT64_C(0xffff)
+#define ARCH_PHASER_PARTY       INT64_C(0x10000)
+#define ARCH_PHASER_PHASE       INT64_C(0x100000000)
+#define ARCH_PHASER_MAX_PARTIES 0xffff
+
+/* The half of the state word holding the phase, x86 and x64 are little-endian. */
+#define ARCH_PHASER_PHASE_HALF  1
+
+typedef struct {
+    union {
+        __int64 state;
+        long half[2]; /* waiters sleep on half[ARCH_PHASER_PHASE_HALF] */
+    } word;
+    long sleepers; /* set while a thread may be blocked on the phase */
+    long waiting; /* threads arriving or waiting, which destroy waits out */
+    unsigned __int64 spin; /* arch_cycles() to spin before blocking */
+} arch_phaser;
+
 typedef struct {
     int pshared;
-    clockid_t *clock_id;
+    clockid_t clock_id;
 } arch_cond_attr;
 
 typedef struct {
-    char cond[8]; /* InitializeConditionVariable */
+    pthread_spinlock_t lock;
+    arch_cond_waiter *head, *tail;
+    clockid_t clock_id; /* CLOCK_REALTIME or CLOCK_MONOTONIC */
 } arch_cond;
 
 typedef struct {
     int pshared;
 } arch_rwlock_attr;
 
+/*
+ * Read-write lock word: bit 0 is held by a writer, bits 1-15 count the
+ * writers waiting, which hold new readers back, and the upper bits count
+ * the readers holding the lock through it.
+ */
+#define ARCH_RWLOCK_WRITER          1
+#define ARCH_RWLOCK_WRITER_WAITER   2
+#define ARCH_RWLOCK_WRITER_WAITERS  0xfffe
+#define ARCH_RWLOCK_READER          0x10000
+
 typedef struct {
-    char rwlock[8]; /* InitializeSRWLock */
+    /* Read by every reader, written on revocation only. */
+    long rbias; /* readers may publish themselves in per-thread slots */
+    __int64 inhibit_until; /* arch_cycles() before which rbias stays off, see atomic_read64() */
+    char pad[64 - 2 * sizeof(unsigned __int64)];
+
+    long state; /* ARCH_RWLOCK_* */
+    long sleepers; /* threads blocked on state */
 } arch_rwlock;
 
+/* Processor topology order for tree barriers (barrier.c) */
+void arch_barrier_init(void);
+
+/* Ticket spin lock backoff calibration (spin.c) */
+void arch_spin_init(void);
+
+/* MCS queue nodes, taken from a per-thread pool (mcs.c) */
+int arch_mcs_init(void);
+void arch_mcs_fini(void);
+void arch_mcs_thread_exit(void);
+
+/* Address-keyed wait/wake backend (wait.c) */
+#define ARCH_WAKE_ALL   LONG_MAX
+
+int arch_wait_init(void);
+void arch_wait_fini(void);
+void arch_wait_thread_exit(void);
+int arch_wait_on_address(volatile long *addr, long compare, DWORD ms);
+void arch_wake_by_address(volatile long *addr, long count);
+__int64 arch_rel_time_in_100ns(const struct timespec *ts);
+unsigned __int64 arch_wait_spin_cycles(int policy);
+
+/* Mutex internals used by condition variables (mutex.c) */
+int arch_mutex_check_unlock(pthread_mutex_t *m, arch_mutex **pv);
+void arch_mutex_requeue(arch_mutex *pv, arch_cond_waiter *head, arch_cond_waiter *tail, long n);
+int arch_mutex_relock(pthread_mutex_t *m, int counted);
+
+/* Visible reader slots of read-write locks (rwlock.c) */
+int arch_rwlock_init(void);
+void arch_rwlock_fini(void);
+void arch_rwlock_thread_exit(void);
+
+/* Cache-line aligned allocator for internal objects (slab.c) */
+int arch_slab_init(void);
+void arch_slab_fini(void);
+void arch_slab_thread_exit(void);
+void *arch_slab_alloc(size_t size);
+void arch_slab_free(void *ptr, size_t size);
+
 /** @} */
 
 #endif
@@ -20,17 +20,302 @@
 /**
  * @file barrier.c
  * @brief Implementation Code of Barrier Routines
+ *
+ * Waiters spin on the barrier epoch for the time given by their wait
+ * policy, so short phases never enter the kernel, and only then sleep on
+ * it with arch_wait_on_address(). A barrier owns no kernel object.
+ *
+ * With many threads a single arrival counter becomes the bottleneck, so
+ * larger barriers count arrivals in a combining tree instead. Processors
+ * are ranked so that SMT siblings are adjacent, then the cores of one L3
+ * domain, and a thread arrives at the leaf of its current processor's
+ * rank, so the first levels combine threads that share a core or a cache.
+ *
+ * pthread_barrier_reduce_np() combines a value per thread on the way up,
+ * so the result is ready when the barrier opens.
  */
 
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
 
 #include <winsock2.h>
 
 #include "arch.h"
 #include "misc.h"
 
+#define ARCH_BARRIER_FANIN      4
+#define ARCH_BARRIER_TREE_MIN   16  /* PTHREAD_BARRIER_DEFAULT_NP threshold */
+#define ARCH_BARRIER_MAX_CPUS   (sizeof(ULONG_PTR) * 8)
+#define ARCH_BARRIER_NO_REDUCE  -1
+
+typedef DWORD (WINAPI *get_current_processor_number_t)(void);
+typedef BOOL (WINAPI *get_logical_processor_information_t)(SYSTEM_LOGICAL_PROCESSOR_INFORMATION *, DWORD *);
+
+static get_current_processor_number_t libpthread_get_current_processor_number;
+static long libpthread_cpu_rank[ARCH_BARRIER_MAX_CPUS];
+static long libpthread_cpu_ranked;
+static ULONG_PTR libpthread_cpu_ranked_mask;
+
+/* Give the next ranks to the processors of mask not ranked yet. */
+static void arch_barrier_rank(ULONG_PTR mask)
+{
+    long i;
+
+    for (i = 0; i < ARCH_BARRIER_MAX_CPUS; i++) {
+        if ((mask & ((ULONG_PTR) 1 << i)) && !(libpthread_cpu_ranked_mask & ((ULONG_PTR) 1 << i))) {
+            libpthread_cpu_ranked_mask |= (ULONG_PTR) 1 << i;
+            libpthread_cpu_rank[i] = libpthread_cpu_ranked++;
+        }
+    }
+}
+
+/**
+ * Rank the processors by topology, called once on process attach.
+ * @remark Without GetLogicalProcessorInformation() (before XP SP3) or
+ *         GetCurrentProcessorNumber() (before Vista), threads are spread
+ *         over the leaves by thread id instead.
+ */
+void arch_barrier_init(void)
+{
+    DWORD i, j, n, size = 0;
+    DWORD_PTR process_mask, system_mask;
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info;
+    get_logical_processor_information_t get_info;
+    HMODULE kernel = GetModuleHandleA("kernel32.dll");
+
+    if (kernel == NULL)
+        return;
+
+    libpthread_get_current_processor_number = (get_current_processor_number_t)
+        GetProcAddress(kernel, "GetCurrentProcessorNumber");
+    get_info = (get_logical_processor_information_t)
+        GetProcAddress(kernel, "GetLogicalProcessorInformation");
+    if (libpthread_get_current_processor_number == NULL || get_info == NULL)
+        return;
+
+    get_info(NULL, & size);
+    if (size == 0 || (info = malloc(size)) == NULL) {
+        libpthread_get_current_processor_number = NULL;
+        return;
+    }
+
+    if (get_info(info, & size)) {
+        n = size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+
+        /* Core by core within each L3 domain, then whatever is left. */
+        for (i = 0; i < n; i++) {
+            if (info[i].Relationship != RelationCache || info[i].Cache.Level != 3)
+                continue;
+            for (j = 0; j < n; j++) {
+                if (info[j].Relationship == RelationProcessorCore)
+                    arch_barrier_rank(info[j].ProcessorMask & info[i].ProcessorMask);
+            }
+        }
+        for (j = 0; j < n; j++) {
+            if (info[j].Relationship == RelationProcessorCore)
+                arch_barrier_rank(info[j].ProcessorMask);
+        }
+    }
+    free(info);
+
+    if (GetProcessAffinityMask(GetCurrentProcess(), & process_mask, & system_mask))
+        arch_barrier_rank(system_mask);
+
+    if (libpthread_cpu_ranked == 0)
+        libpthread_get_current_processor_number = NULL;
+}
+
+/* The leaf the calling thread tries first. */
+static __inline long arch_barrier_leaf(arch_barrier *pv)
+{
+    DWORD cpu;
+
+    if (libpthread_get_current_processor_number == NULL)
+        return (long) (GetCurrentThreadId() >> 2) % pv->leaves;
+
+    cpu = libpthread_get_current_processor_number() % ARCH_BARRIER_MAX_CPUS;
+    return (long) ((__int64) libpthread_cpu_rank[cpu] * pv->leaves / libpthread_cpu_ranked);
+}
+
+/*
+ * Build the arrival nodes for count threads, with the given fan-in at every
+ * level. A fan-in of count gives a single node, the flat barrier.
+ */
+static int arch_barrier_tree_init(arch_barrier *pv, long count, long fanin)
+{
+    long i, width, offset, below, slots, nodes = 0;
+    arch_barrier_node *node;
+
+    for (width = count; ; width = (width + fanin - 1) / fanin) {
+        nodes += (width + fanin - 1) / fanin;
+        if (width <= fanin)
+            break;
+    }
+
+    pv->tree = _aligned_malloc(nodes * sizeof(arch_barrier_node), sizeof(arch_barrier_node));
+    if (pv->tree == NULL)
+        return 0;
+    memset(pv->tree, 0, nodes * sizeof(arch_barrier_node));
+
+    /* one slot per arrival at every node, as many as threads plus children */
+    pv->slots = _aligned_malloc((count + nodes) * sizeof(arch_barrier_slot), sizeof(arch_barrier_node));
+    if (pv->slots == NULL) {
+        _aligned_free(pv->tree);
+        return 0;
+    }
+    memset(pv->slots, 0, (count + nodes) * sizeof(arch_barrier_slot));
+
+    pv->nodes = nodes;
+    pv->leaves = (count + fanin - 1) / fanin;
+
+    /* below: arrivals expected at this level, from threads or children */
+    offset = 0;
+    slots = 0;
+    below = count;
+    do {
+        width = (below + fanin - 1) / fanin;
+        for (i = 0; i < width; i++) {
+            node = pv->tree + offset + i;
+            node->capacity = below - i * fanin;
+            if (node->capacity > fanin)
+                node->capacity = fanin;
+            node->slots = slots;
+            slots += node->capacity;
+        }
+        for (i = 0; i < width; i++) {
+            node = pv->tree + offset + i;
+            node->parent = width > 1 ? offset + width + i / fanin : -1;
+            node->slot = width > 1 ? slots + i : -1;
+        }
+        offset += width;
+        below = width;
+    } while (below > 1);
+
+    return 1;
+}
+
+static __inline int64_t arch_barrier_apply(int op, pthread_reduce_fn_np fn, int64_t a, int64_t b)
+{
+    switch (op) {
+    case PTHREAD_REDUCE_SUM_NP:
+        return a + b;
+    case PTHREAD_REDUCE_MIN_NP:
+        return a < b ? a : b;
+    case PTHREAD_REDUCE_MAX_NP:
+        return a > b ? a : b;
+    default:
+        return fn(a, b);
+    }
+}
+
+static __inline void arch_barrier_publish(arch_barrier_slot *slot, int64_t value, long stamp)
+{
+    slot->value = value;
+    atomic_set_release(& slot->stamp, stamp);
+}
+
+/*
+ * Combine the values given at a node in this phase. Arrivals at a leaf
+ * publish their value just after they claim their place, so the last one
+ * may find a value still on its way.
+ */
+static int64_t arch_barrier_combine(arch_barrier *pv, arch_barrier_node *node,
+    long stamp, int op, pthread_reduce_fn_np fn)
+{
+    long i;
+    int64_t value = 0;
+    arch_barrier_slot *slot = pv->slots + node->slots;
+
+    for (i = 0; i < node->capacity; i++) {
+        while (atomic_read_acquire(& slot[i].stamp) != stamp)
+            cpu_relax();
+        value = i == 0 ? slot[i].value : arch_barrier_apply(op, fn, value, slot[i].value);
+    }
+
+    return value;
+}
+
+/* Start the next phase, called by the last arrival. */
+static void arch_barrier_release(arch_barrier *pv, int64_t result)
+{
+    long i;
+
+    for (i = 0; i < pv->nodes; i++)
+        pv->tree[i].count = 0;
+    pv->result = result;
+
+    atomic_fetch_and_add(& pv->leaving, pv->total);
+    atomic_fetch_and_add(& pv->epoch, 1);
+    if (atomic_xchg(& pv->sleepers, 0))
+        arch_wake_by_address(& pv->epoch, ARCH_WAKE_ALL);
+}
+
+/*
+ * Arrive in phase epoch, reducing value by op unless op is
+ * ARCH_BARRIER_NO_REDUCE, and return nonzero for the last arrival, which
+ * has started the next phase. A leaf takes its capacity of threads in a
+ * phase, later ones move on to the next leaf, and as the capacities add up
+ * to the barrier count every thread finds a place before the phase ends.
+ */
+static int arch_barrier_arrive(arch_barrier *pv, long epoch, int op, pthread_reduce_fn_np fn, int64_t value)
+{
+    long i = pv->leaves > 1 ? arch_barrier_leaf(pv) : 0, n;
+    arch_barrier_node *node;
+
+    while (1) {
+        node = pv->tree + i;
+        if ((n = atomic_fetch_and_add(& node->count, 1)) < node->capacity)
+            break;
+        if (++i == pv->leaves)
+            i = 0;
+    }
+
+    if (op != ARCH_BARRIER_NO_REDUCE)
+        arch_barrier_publish(pv->slots + node->slots + n, value, epoch + 1);
+
+    while (n == node->capacity - 1) {
+        if (op != ARCH_BARRIER_NO_REDUCE)
+            value = arch_barrier_combine(pv, node, epoch + 1, op, fn);
+
+        if (node->parent < 0) {
+            arch_barrier_release(pv, value);
+            return 1;
+        }
+
+        /* A child publishes before it arrives, its parent never waits. */
+        if (op != ARCH_BARRIER_NO_REDUCE)
+            arch_barrier_publish(pv->slots + node->slot, value, epoch + 1);
+        node = pv->tree + node->parent;
+        n = atomic_fetch_and_add(& node->count, 1);
+    }
+
+    return 0;
+}
+
+/* Wait until phase epoch has ended, return at once if it has. */
+static void arch_barrier_wait_for(arch_barrier *pv, long epoch)
+{
+    unsigned __int64 deadline;
+
+    if (pv->spin > 0) {
+        deadline = arch_cycles() + pv->spin;
+        while (atomic_read_acquire(& pv->epoch) == epoch) {
+            if (arch_cycles() >= deadline)
+                break;
+            cpu_relax();
+        }
+    }
+
+    if (atomic_read_acquire(& pv->epoch) == epoch) {
+        atomic_xchg(& pv->sleepers, 1);
+        while (atomic_read(& pv->epoch) == epoch)
+            arch_wait_on_address(& pv->epoch, epoch, INFINITE);
+    }
+}
+
 /**
  * Create a barrier attribute object.
  * @param attr The pointer of the barrier attribute object.
@@ -40,11 +325,13 @@
  */
 int pthread_barrierattr_init(pthread_barrierattr_t *attr)
 {
-    arch_barrier_attr *pv = calloc(1, sizeof(arch_barrier_attr));
+    arch_barrier_attr *pv = arch_slab_alloc(sizeof(arch_barrier_attr));
     if (pv == NULL)
         return ENOMEM;
 
     pv->pshared = PTHREAD_PROCESS_PRIVATE;
+    pv->wait_policy = PTHREAD_WAIT_POLICY_DEFAULT_NP;
+    pv->type = PTHREAD_BARRIER_DEFAULT_NP;
 
     *attr = pv;
 
@@ -61,7 +348,7 @@ int pthread_barrierattr_init(pthread_barrierattr_t *attr)
  */
 int pthread_barrierattr_getpshared(const pthread_barrierattr_t *attr, int *pshared)
 {
-    arch_barrier_attr *pv = (arch_barrier_attr *) attr;
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
     *pshared = pv->pshared;
     return 0;
 }
@@ -76,11 +363,80 @@ int pthread_barrierattr_getpshared(const pthread_barrierattr_t *attr, int *pshar
  */
 int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int pshared)
 {
-    arch_barrier_attr *pv = (arch_barrier_attr *) attr;
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
     pv->pshared = pshared;
     return 0;
 }
 
+/**
+ * Get the barrier wait policy attribute.
+ * @param attr The pointer of the barrier attribute object.
+ * @param policy The wait policy, one of PTHREAD_WAIT_POLICY_*_NP.
+ * @return Always return 0.
+ */
+int pthread_barrierattr_getwaitpolicy_np(const pthread_barrierattr_t *attr, int *policy)
+{
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
+    *policy = pv->wait_policy;
+    return 0;
+}
+
+/**
+ * Set the barrier wait policy attribute.
+ * @param attr The pointer of the barrier attribute object.
+ * @param policy PTHREAD_WAIT_POLICY_DEFAULT_NP to spin briefly before
+ *        blocking, or as the LIBPTHREAD_WAIT_POLICY environment variable
+ *        says; PTHREAD_WAIT_POLICY_PASSIVE_NP to block at once;
+ *        PTHREAD_WAIT_POLICY_ACTIVE_NP to spin much longer before blocking.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ */
+int pthread_barrierattr_setwaitpolicy_np(pthread_barrierattr_t *attr, int policy)
+{
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
+
+    if (policy != PTHREAD_WAIT_POLICY_DEFAULT_NP && policy != PTHREAD_WAIT_POLICY_PASSIVE_NP
+        && policy != PTHREAD_WAIT_POLICY_ACTIVE_NP)
+        return EINVAL;
+
+    pv->wait_policy = policy;
+    return 0;
+}
+
+/**
+ * Get the barrier type attribute.
+ * @param attr The pointer of the barrier attribute object.
+ * @param type The barrier type, one of PTHREAD_BARRIER_*_NP.
+ * @return Always return 0.
+ */
+int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *attr, int *type)
+{
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
+    *type = pv->type;
+    return 0;
+}
+
+/**
+ * Set the barrier type attribute.
+ * @param attr The pointer of the barrier attribute object.
+ * @param type PTHREAD_BARRIER_FLAT_NP to count arrivals on one counter,
+ *        PTHREAD_BARRIER_TREE_NP to count them in a combining tree, or
+ *        PTHREAD_BARRIER_DEFAULT_NP to use the tree for 16 threads or more.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ */
+int pthread_barrierattr_settype_np(pthread_barrierattr_t *attr, int type)
+{
+    arch_barrier_attr *pv = (arch_barrier_attr *) *attr;
+
+    if (type != PTHREAD_BARRIER_DEFAULT_NP && type != PTHREAD_BARRIER_FLAT_NP
+        && type != PTHREAD_BARRIER_TREE_NP)
+        return EINVAL;
+
+    pv->type = type;
+    return 0;
+}
+
 /**
  * Destroy a barrier attribute object.
  * @param attr The pointer of the barrier attribute object.
@@ -90,7 +446,7 @@ int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int pshared)
 int pthread_barrierattr_destroy(pthread_barrierattr_t *attr)
 {
     if (attr != NULL) {
-        free(*attr);
+        arch_slab_free(*attr, sizeof(arch_barrier_attr));
         *attr = NULL;
     }
 
@@ -105,32 +461,37 @@ int pthread_barrierattr_destroy(pthread_barrierattr_t *attr)
  *        before  any  of  them successfully return from the call.
  * @return If the function succeeds, the return value is 0.
  *         If the function fails, the return value is -1,
- *         with errno set to indicate the error (EINVAL, ENOMEM, or EAGAIN).
+ *         with errno set to indicate the error (EINVAL or ENOMEM).
  * @remark We provide pthread_barrierattr_* functions only for compatibility,
  *         please use pthread_barrier_init(&barrier, NULL, count) for new applications.
  */
 int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count)
 {
     arch_barrier *pv;
+    int policy = PTHREAD_WAIT_POLICY_DEFAULT_NP;
+    int type = PTHREAD_BARRIER_DEFAULT_NP;
 
     if (count < 1)
         return lc_set_errno(EINVAL);
 
-    if ((pv = calloc(1, sizeof(arch_barrier))) == NULL)
-        return lc_set_errno(ENOMEM);
+    if (attr != NULL && *attr != NULL) {
+        policy = ((arch_barrier_attr *) *attr)->wait_policy;
+        type = ((arch_barrier_attr *) *attr)->type;
+    }
+
+    if (type == PTHREAD_BARRIER_DEFAULT_NP)
+        type = count >= ARCH_BARRIER_TREE_MIN ? PTHREAD_BARRIER_TREE_NP : PTHREAD_BARRIER_FLAT_NP;
 
-    if ((pv->semaphore[0] = CreateSemaphore(NULL, 0, count, NULL)) == NULL)
-        return lc_set_errno(EAGAIN);
+    if ((pv = arch_slab_alloc(sizeof(arch_barrier))) == NULL)
+        return lc_set_errno(ENOMEM);
 
-    if ((pv->semaphore[1] = CreateSemaphore(NULL, 0, count, NULL)) == NULL) {
-        long rc = GetLastError();
-        CloseHandle(pv->semaphore[0]);
-        SetLastError(rc);
-        return lc_set_errno(EAGAIN);
+    if (!arch_barrier_tree_init(pv, count, type == PTHREAD_BARRIER_TREE_NP ? ARCH_BARRIER_FANIN : count)) {
+        arch_slab_free(pv, sizeof(arch_barrier));
+        return lc_set_errno(ENOMEM);
     }
 
     pv->total = count;
-    pv->count = count;
+    pv->spin = arch_wait_spin_cycles(policy);
     *barrier = pv;
 
     return 0;
@@ -139,31 +500,122 @@ int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t
 /**
  * Wait on a barrier lock.
  * @param m The pointer of the barrier object.
- * @return If the function succeeds, the return value is 0.
+ * @return If the function succeeds, the return value is 0, or
+ *         PTHREAD_BARRIER_SERIAL_THREAD for one of the threads.
  *         If the function fails, the return value is -1,
  *         with errno set to indicate the error (EINVAL).
  */
 int pthread_barrier_wait(pthread_barrier_t *barrier)
 {
-    long rc, index;
+    long epoch;
+    int rc;
     arch_barrier *pv = (arch_barrier *) *barrier;
 
     if (pv == NULL)
         return lc_set_errno(EINVAL);
 
-    if (atomic_fetch_and_add(& pv->count, -1) != 1) {
-        WaitForSingleObject(pv->semaphore[pv->index], INFINITE);
-        return 0;
-    }
+    /* Read before arriving, the epoch cannot move until we have arrived. */
+    epoch = atomic_read_acquire(& pv->epoch);
+
+    rc = arch_barrier_arrive(pv, epoch, ARCH_BARRIER_NO_REDUCE, NULL, 0);
+    if (!rc)
+        arch_barrier_wait_for(pv, epoch);
+
+    /* The last touch, pthread_barrier_destroy() may free it after this. */
+    atomic_fetch_and_add(& pv->leaving, -1);
+    return rc ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+/**
+ * Arrive at a barrier without waiting for the other threads.
+ * @param barrier The pointer of the barrier object.
+ * @param token The pointer to receive the phase token for
+ *        pthread_barrier_wait_token_np().
+ * @return If the function succeeds, the return value is 0, or
+ *         PTHREAD_BARRIER_SERIAL_THREAD for the last thread to arrive.
+ *         If the function fails, the return value is -1,
+ *         with errno set to indicate the error (EINVAL).
+ * @remark Every arrival must be followed by exactly one call to
+ *         pthread_barrier_wait_token_np() before the thread arrives again.
+ */
+int pthread_barrier_arrive_np(pthread_barrier_t *barrier, long *token)
+{
+    long epoch;
+    arch_barrier *pv = (arch_barrier *) *barrier;
+
+    if (pv == NULL || token == NULL)
+        return lc_set_errno(EINVAL);
+
+    *token = epoch = atomic_read_acquire(& pv->epoch);
+
+    if (arch_barrier_arrive(pv, epoch, ARCH_BARRIER_NO_REDUCE, NULL, 0))
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+
+    return 0;
+}
+
+/**
+ * Wait for the phase of an earlier arrival to complete.
+ * @param barrier The pointer of the barrier object.
+ * @param token The phase token from pthread_barrier_arrive_np().
+ * @return If the function succeeds, the return value is 0.
+ *         If the function fails, the return value is -1,
+ *         with errno set to indicate the error (EINVAL).
+ * @remark Returns at once if the phase has already completed, so the work
+ *         done between the two calls hides the latency of the stragglers.
+ */
+int pthread_barrier_wait_token_np(pthread_barrier_t *barrier, long token)
+{
+    arch_barrier *pv = (arch_barrier *) *barrier;
+
+    if (pv == NULL)
+        return lc_set_errno(EINVAL);
+
+    arch_barrier_wait_for(pv, token);
+
+    atomic_fetch_and_add(& pv->leaving, -1);
+    return 0;
+}
+
+/**
+ * Wait on a barrier lock and reduce a value over all the threads.
+ * @param barrier The pointer of the barrier object.
+ * @param value The value of the calling thread.
+ * @param op PTHREAD_REDUCE_SUM_NP, PTHREAD_REDUCE_MIN_NP,
+ *        PTHREAD_REDUCE_MAX_NP, or PTHREAD_REDUCE_CUSTOM_NP to use fn.
+ * @param fn The reduction for PTHREAD_REDUCE_CUSTOM_NP, ignored otherwise.
+ * @param result The pointer to receive the reduction of all the values
+ *        given in this phase, the same in every thread.
+ * @return If the function succeeds, the return value is 0, or
+ *         PTHREAD_BARRIER_SERIAL_THREAD for one of the threads.
+ *         If the function fails, the return value is -1,
+ *         with errno set to indicate the error (EINVAL).
+ * @remark The values are combined as the threads arrive, so the result is
+ *         ready when the barrier opens. Every thread of a phase must pass
+ *         the same op, and fn must be associative and commutative, since
+ *         the order of the values is not defined.
+ */
+int pthread_barrier_reduce_np(pthread_barrier_t *barrier, int64_t value, int op,
+    pthread_reduce_fn_np fn, int64_t *result)
+{
+    long epoch;
+    int rc;
+    arch_barrier *pv = (arch_barrier *) *barrier;
+
+    if (pv == NULL || result == NULL || op < PTHREAD_REDUCE_SUM_NP || op > PTHREAD_REDUCE_CUSTOM_NP
+        || (op == PTHREAD_REDUCE_CUSTOM_NP && fn == NULL))
+        return lc_set_errno(EINVAL);
 
-    index = pv->index;
-    if (index) pv->index = 0; else pv->index = 1;
+    epoch = atomic_read_acquire(& pv->epoch);
 
-    pv->count = pv->total;
-    if (pv->total > 1)
-        ReleaseSemaphore(pv->semaphore[index], pv->total - 1, NULL);
+    rc = arch_barrier_arrive(pv, epoch, op, fn, value);
+    if (!rc)
+        arch_barrier_wait_for(pv, epoch);
 
-    return PTHREAD_BARRIER_SERIAL_THREAD;
+    /* Not overwritten before we arrive again. */
+    *result = pv->result;
+    atomic_fetch_and_add(& pv->leaving, -1);
+    return rc ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
 }
 
 /**
@@ -175,9 +627,13 @@ int pthread_barrier_destroy(pthread_barrier_t *barrier)
 {
     arch_barrier *pv = (arch_barrier *) *barrier;
     if (pv != NULL) {
-        if (pv->semaphore[0] != NULL) CloseHandle(pv->semaphore[0]);
-        if (pv->semaphore[1] != NULL) CloseHandle(pv->semaphore[1]);
-        free(pv);
+        /* Released threads may not have left pthread_barrier_wait() yet. */
+        while (atomic_read(& pv->leaving) > 0)
+            cpu_relax();
+        _aligned_free(pv->tree);
+        _aligned_free(pv->slots);
+        arch_slab_free(pv, sizeof(arch_barrier));
+        *barrier = NULL;
     }
 
     return 0;
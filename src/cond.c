@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file cond.c
+ * @brief Implementation Code of Condition Variable Routines
+ *
+ * Waiters queue in FIFO order on the condition variable and each sleeps on
+ * its own state word. Signal and broadcast do not wake them: they move the
+ * waiters to the queue of the mutex (wait morphing), and every unlock of the
+ * mutex wakes one of them. A broadcast to many waiters therefore costs one
+ * wakeup per unlock, rather than a herd that wakes only to block again on
+ * the mutex.
+ */
+
+#include <pthread.h>
+#include <pthread_clock.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+/**
+ * Create a condition variable attribute object.
+ * @param attr The pointer of the condition variable attribute object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, ENOMEM returned to indicate the error.
+ */
+int pthread_condattr_init(pthread_condattr_t *attr)
+{
+    arch_cond_attr *pv = arch_slab_alloc(sizeof(arch_cond_attr));
+    if (pv == NULL)
+        return ENOMEM;
+
+    pv->pshared = PTHREAD_PROCESS_PRIVATE;
+    pv->clock_id = CLOCK_REALTIME;
+
+    *attr = pv;
+
+    return 0;
+}
+
+/**
+ * Get the clock used by pthread_cond_timedwait().
+ * @param attr The pointer of the condition variable attribute object.
+ * @param clock_id The clock id.
+ * @return Always return 0.
+ */
+int pthread_condattr_getclock(const pthread_condattr_t *attr, clockid_t *clock_id)
+{
+    arch_cond_attr *pv = (arch_cond_attr *) *attr;
+    *clock_id = pv->clock_id;
+    return 0;
+}
+
+/**
+ * Set the clock used by pthread_cond_timedwait().
+ * @param attr The pointer of the condition variable attribute object.
+ * @param clock_id CLOCK_REALTIME or CLOCK_MONOTONIC.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ * @remark With CLOCK_MONOTONIC, deadlines are not moved by changes of the
+ *         system time.
+ */
+int pthread_condattr_setclock(pthread_condattr_t *attr, clockid_t clock_id)
+{
+    arch_cond_attr *pv = (arch_cond_attr *) *attr;
+
+    if (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC)
+        return EINVAL;
+
+    pv->clock_id = clock_id;
+    return 0;
+}
+
+/**
+ * Get the condition variable process-shared attribute.
+ * @param attr The pointer of the condition variable attribute object.
+ * @param pshared The process-shared attribute.
+ * @return Always return 0.
+ */
+int pthread_condattr_getpshared(const pthread_condattr_t *attr, int *pshared)
+{
+    arch_cond_attr *pv = (arch_cond_attr *) *attr;
+    *pshared = pv->pshared;
+    return 0;
+}
+
+/**
+ * Set the condition variable process-shared attribute.
+ * @param attr The pointer of the condition variable attribute object.
+ * @param pshared The process-shared attribute.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL or ENOTSUP returned to indicate the error.
+ * @remark The only type we support is PTHREAD_PROCESS_PRIVATE.
+ */
+int pthread_condattr_setpshared(pthread_condattr_t *attr, int pshared)
+{
+    arch_cond_attr *pv = (arch_cond_attr *) *attr;
+
+    if (pshared == PTHREAD_PROCESS_SHARED)
+        return ENOTSUP;
+    if (pshared != PTHREAD_PROCESS_PRIVATE)
+        return EINVAL;
+
+    pv->pshared = pshared;
+    return 0;
+}
+
+/**
+ * Destroy a condition variable attribute object.
+ * @param attr The pointer of the condition variable attribute object.
+ * @return Always return 0.
+ */
+int pthread_condattr_destroy(pthread_condattr_t *attr)
+{
+    if (attr != NULL) {
+        arch_slab_free(*attr, sizeof(arch_cond_attr));
+        *attr = NULL;
+    }
+
+    return 0;
+}
+
+static int arch_cond_init(pthread_cond_t *c, const pthread_condattr_t *a, int lock)
+{
+    arch_cond *pv = arch_slab_alloc(sizeof(arch_cond));
+    if (pv == NULL)
+        return ENOMEM;
+
+    pv->clock_id = CLOCK_REALTIME;
+    if (a != NULL && *a != NULL)
+        pv->clock_id = ((arch_cond_attr *) *a)->clock_id;
+
+    if (!lock) {
+        *c = pv;
+        return 0;
+    }
+
+    if (atomic_cmpxchg_ptr(c, pv, NULL) != NULL) {
+        arch_slab_free(pv, sizeof(arch_cond));
+    }
+
+    return 0;
+}
+
+/**
+ * Create a condition variable.
+ * @param c The pointer of the condition variable.
+ * @param a The pointer of the condition variable attribute object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, ENOMEM returned to indicate the error.
+ * @remark PTHREAD_COND_INITIALIZER is also supported, the object is then
+ *         created on first wait.
+ */
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *a)
+{
+    *c = NULL;
+    return arch_cond_init(c, a, 0);
+}
+
+/**
+ * Destroy a condition variable.
+ * @param c The pointer of the condition variable.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EBUSY returned if threads are waiting on it.
+ */
+int pthread_cond_destroy(pthread_cond_t *c)
+{
+    arch_cond *pv = (arch_cond *) *c;
+
+    if (pv != NULL) {
+        if (pv->head != NULL)
+            return EBUSY;
+        arch_slab_free(pv, sizeof(arch_cond));
+        *c = NULL;
+    }
+
+    return 0;
+}
+
+static __inline void arch_cond_unlink(arch_cond *pv, arch_cond_waiter *node)
+{
+    if (node->prev != NULL) node->prev->next = node->next;
+    else pv->head = node->next;
+
+    if (node->next != NULL) node->next->prev = node->prev;
+    else pv->tail = node->prev;
+
+    node->next = node->prev = NULL;
+}
+
+/*
+ * Take a waiter that timed out off the queue, unless a signal got to it
+ * first. Returns 1 if it was removed.
+ */
+static int arch_cond_cancel(arch_cond *pv, arch_cond_waiter *node)
+{
+    int removed = 0;
+
+    pthread_spin_lock(& pv->lock);
+    if (node->state == ARCH_COND_WAITING) {
+        arch_cond_unlink(pv, node);
+        node->state = ARCH_COND_SIGNALED;
+        removed = 1;
+    }
+    pthread_spin_unlock(& pv->lock);
+
+    return removed;
+}
+
+/* Time remaining until an absolute deadline on the clock of the condition. */
+static __int64 arch_cond_rel_time_in_100ns(arch_cond *pv, const struct timespec *abs_timeout)
+{
+    struct timespec now;
+
+    if (pv->clock_id == CLOCK_REALTIME)
+        return arch_rel_time_in_100ns(abs_timeout);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (abs_timeout->tv_sec - now.tv_sec) * POW10_7 + (abs_timeout->tv_nsec - now.tv_nsec) / 100;
+}
+
+static int arch_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *abs_timeout)
+{
+    int rc, timedout = 0;
+    long state;
+    __int64 rel;
+    DWORD ms;
+    arch_cond *pv;
+    arch_cond_waiter node;
+
+    if (*c == NULL) {
+        if ((rc = arch_cond_init(c, NULL, 1)) != 0)
+            return rc;
+    }
+
+    pv = (arch_cond *) *c;
+    if ((rc = arch_mutex_check_unlock(m, & node.mutex)) != 0)
+        return rc;
+
+    /* Queue up before unlocking, so no signal in between is lost. */
+    node.state = ARCH_COND_WAITING;
+    node.next = NULL;
+    pthread_spin_lock(& pv->lock);
+    node.prev = pv->tail;
+    if (pv->tail != NULL) pv->tail->next = & node;
+    else pv->head = & node;
+    pv->tail = & node;
+    pthread_spin_unlock(& pv->lock);
+
+    pthread_mutex_unlock(m);
+
+    while ((state = atomic_read(& node.state)) == ARCH_COND_WAITING) {
+        ms = INFINITE;
+        if (abs_timeout != NULL) {
+            if ((rel = arch_cond_rel_time_in_100ns(pv, abs_timeout)) <= 0) {
+                if (arch_cond_cancel(pv, & node)) {
+                    timedout = 1;
+                    break;
+                }
+                continue;
+            }
+
+            rel /= POW10_4;
+            if (rel == 0) {
+                /* Less than a millisecond left, don't let the kernel round it. */
+                SwitchToThread();
+                continue;
+            }
+            ms = rel >= MAX_SLEEP_IN_MS ? MAX_SLEEP_IN_MS : (DWORD) rel;
+        }
+
+        (void) arch_wait_on_address(& node.state, ARCH_COND_WAITING, ms);
+    }
+
+    /* On the mutex queue now: the deadline no longer applies, as in POSIX. */
+    while ((state = atomic_read(& node.state)) == ARCH_COND_MORPHED)
+        (void) arch_wait_on_address(& node.state, ARCH_COND_MORPHED, INFINITE);
+
+    arch_mutex_relock(m, state == ARCH_COND_WOKEN);
+
+    return timedout ? ETIMEDOUT : 0;
+}
+
+/**
+ * Wait on a condition variable.
+ * @param c The pointer of the condition variable.
+ * @param m The pointer of the mutex object, locked by the calling thread.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EINVAL or EPERM).
+ */
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+    return arch_cond_wait(c, m, NULL);
+}
+
+/**
+ * Wait on a condition variable, or give up at an absolute deadline.
+ * @param c The pointer of the condition variable.
+ * @param m The pointer of the mutex object, locked by the calling thread.
+ * @param t The absolute deadline, measured by the clock set with
+ *        pthread_condattr_setclock(), CLOCK_REALTIME by default.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EINVAL, EPERM or ETIMEDOUT).
+ * @remark The mutex is held again on return, also on ETIMEDOUT.
+ */
+int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *t)
+{
+    if (t == NULL || t->tv_nsec < 0 || t->tv_nsec >= POW10_9)
+        return EINVAL;
+
+    return arch_cond_wait(c, m, t);
+}
+
+/*
+ * Move a chain of waiters, already off the condition queue and marked
+ * ARCH_COND_MORPHED, to their mutexes, one run per mutex.
+ */
+static void arch_cond_requeue(arch_cond_waiter *head)
+{
+    long n;
+    arch_cond_waiter *tail, *next;
+
+    while (head != NULL) {
+        for (tail = head, n = 1; tail->next != NULL && tail->next->mutex == head->mutex; n++)
+            tail = tail->next;
+
+        next = tail->next;
+        tail->next = NULL;
+        arch_mutex_requeue(head->mutex, head, tail, n);
+        head = next;
+    }
+}
+
+/**
+ * Unblock the longest waiting thread of a condition variable.
+ * @param c The pointer of the condition variable.
+ * @return Always return 0.
+ */
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    arch_cond *pv = (arch_cond *) *c;
+    arch_cond_waiter *node;
+
+    if (pv == NULL || pv->head == NULL)
+        return 0;
+
+    pthread_spin_lock(& pv->lock);
+    if ((node = pv->head) != NULL) {
+        arch_cond_unlink(pv, node);
+        node->state = ARCH_COND_MORPHED;
+    }
+    pthread_spin_unlock(& pv->lock);
+
+    if (node != NULL)
+        arch_cond_requeue(node);
+
+    return 0;
+}
+
+/**
+ * Unblock all threads waiting on a condition variable.
+ * @param c The pointer of the condition variable.
+ * @return Always return 0.
+ * @remark The waiters are moved to the mutex in FIFO order and then woken
+ *         one by one as the mutex is released.
+ */
+int pthread_cond_broadcast(pthread_cond_t *c)
+{
+    arch_cond *pv = (arch_cond *) *c;
+    arch_cond_waiter *head, *node;
+
+    if (pv == NULL || pv->head == NULL)
+        return 0;
+
+    pthread_spin_lock(& pv->lock);
+    head = pv->head;
+    for (node = head; node != NULL; node = node->next)
+        node->state = ARCH_COND_MORPHED;
+    pv->head = pv->tail = NULL;
+    pthread_spin_unlock(& pv->lock);
+
+    arch_cond_requeue(head);
+
+    return 0;
+}
@@ -24,9 +24,15 @@
 
 #include <winsock2.h>
 
+#include "arch.h"
+
 DWORD libpthread_tls_index;
 
 static BOOL libpthread_fini(void) {
+    arch_mcs_fini();
+    arch_rwlock_fini();
+    arch_wait_fini();
+    arch_slab_fini();
     TlsFree(libpthread_tls_index);
     return TRUE;
 }
@@ -35,6 +41,35 @@ static BOOL libpthread_init(void) {
     if ((libpthread_tls_index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
         return FALSE;
 
+    arch_spin_init();
+    arch_barrier_init();
+
+    if (!arch_wait_init()) {
+        TlsFree(libpthread_tls_index);
+        return FALSE;
+    }
+
+    if (!arch_slab_init()) {
+        arch_wait_fini();
+        TlsFree(libpthread_tls_index);
+        return FALSE;
+    }
+
+    if (!arch_rwlock_init()) {
+        arch_slab_fini();
+        arch_wait_fini();
+        TlsFree(libpthread_tls_index);
+        return FALSE;
+    }
+
+    if (!arch_mcs_init()) {
+        arch_rwlock_fini();
+        arch_slab_fini();
+        arch_wait_fini();
+        TlsFree(libpthread_tls_index);
+        return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -45,6 +80,13 @@ DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
     case DLL_PROCESS_ATTACH:
         return libpthread_init();
 
+    case DLL_THREAD_DETACH:
+        arch_wait_thread_exit();
+        arch_rwlock_thread_exit();
+        arch_mcs_thread_exit();
+        arch_slab_thread_exit();
+        break;
+
     case DLL_PROCESS_DETACH:
         return libpthread_fini();
     }
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file mcs.c
+ * @brief Implementation Code of MCS Queue Lock Routines
+ *
+ * Mellor-Crummey and Scott's queue lock. Waiters form a linked queue of
+ * nodes and each spins on the flag of its own node, which only its
+ * predecessor writes, once. An unlock therefore touches one waiter's cache
+ * line instead of invalidating the lock line in every waiter's cache, as
+ * the ticket lock does.
+ *
+ * Nodes are taken from a free list kept per thread in TLS, so nested locks
+ * work and the API matches pthread_spin_*. The holder's node is kept in the
+ * lock, only the holder reads it.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+static DWORD libpthread_mcs_tls_index = TLS_OUT_OF_INDEXES;
+
+static __inline arch_mcs_node *arch_mcs_node_get(void)
+{
+    arch_mcs_node *node = TlsGetValue(libpthread_mcs_tls_index);
+
+    if (node == NULL)
+        return arch_slab_alloc(sizeof(arch_mcs_node));
+
+    TlsSetValue(libpthread_mcs_tls_index, node->next);
+    return node;
+}
+
+static __inline void arch_mcs_node_put(arch_mcs_node *node)
+{
+    node->next = TlsGetValue(libpthread_mcs_tls_index);
+    TlsSetValue(libpthread_mcs_tls_index, node);
+}
+
+/**
+ * Initialize a MCS lock.
+ * @param  lock The MCS lock object.
+ * @param  pshared Must be PTHREAD_PROCESS_PRIVATE (0).
+ * @return If the pshared is PTHREAD_PROCESS_PRIVATE, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ */
+int pthread_mcs_init(pthread_mcs_lock_t *lock, int pshared)
+{
+    if (PTHREAD_PROCESS_PRIVATE != pshared)
+        return EINVAL;
+
+    lock->tail = NULL;
+    lock->owner = NULL;
+
+    return 0;
+}
+
+/**
+ * Acquire a MCS lock.
+ * @param  lock The MCS lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, ENOMEM returned if no queue node could be allocated.
+ */
+int pthread_mcs_lock(pthread_mcs_lock_t *lock)
+{
+    arch_mcs_node *node = arch_mcs_node_get(), *prev;
+
+    if (node == NULL)
+        return ENOMEM;
+
+    node->next = NULL;
+    node->locked = 1;
+
+    if ((prev = atomic_xchg_ptr(& lock->tail, node)) != NULL) {
+        prev->next = node;
+        while (atomic_read(& node->locked))
+            cpu_relax();
+    }
+
+    lock->owner = node;
+    return 0;
+}
+
+/**
+ * Try acquire a MCS lock.
+ * @param  lock The MCS lock object.
+ * @return If it can acquire lock immediately, the return value is 0.
+ *         Otherwise, EBUSY (or ENOMEM) returned to indicate the error.
+ */
+int pthread_mcs_trylock(pthread_mcs_lock_t *lock)
+{
+    arch_mcs_node *node;
+
+    if (lock->tail != NULL)
+        return EBUSY;
+
+    if ((node = arch_mcs_node_get()) == NULL)
+        return ENOMEM;
+
+    node->next = NULL;
+    if (atomic_cmpxchg_ptr(& lock->tail, node, NULL) != NULL) {
+        arch_mcs_node_put(node);
+        return EBUSY;
+    }
+
+    lock->owner = node;
+    return 0;
+}
+
+/**
+ * Release a MCS lock.
+ * @param  lock The MCS lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EPERM returned if the lock is not held.
+ */
+int pthread_mcs_unlock(pthread_mcs_lock_t *lock)
+{
+    arch_mcs_node *node = lock->owner;
+
+    if (node == NULL)
+        return EPERM;
+
+    /* Only the holder writes owner, cleared before the lock is passed on. */
+    lock->owner = NULL;
+
+    if (node->next == NULL) {
+        /* No successor yet, leave the lock free unless one is enqueuing. */
+        if (atomic_cmpxchg_ptr(& lock->tail, NULL, node) == node) {
+            arch_mcs_node_put(node);
+            return 0;
+        }
+
+        while (node->next == NULL)
+            cpu_relax();
+    }
+
+    atomic_set(& node->next->locked, 0);
+    arch_mcs_node_put(node);
+
+    return 0;
+}
+
+/**
+ * Destroy a MCS lock (reset to unlocked state).
+ * @param  lock The MCS lock object.
+ * @return Always return 0.
+ */
+int pthread_mcs_destroy(pthread_mcs_lock_t *lock)
+{
+    lock->tail = NULL;
+    lock->owner = NULL;
+
+    return 0;
+}
+
+/**
+ * Release the queue nodes of the calling thread, called on thread detach.
+ */
+void arch_mcs_thread_exit(void)
+{
+    arch_mcs_node *node, *next;
+
+    if (libpthread_mcs_tls_index == TLS_OUT_OF_INDEXES)
+        return;
+
+    for (node = TlsGetValue(libpthread_mcs_tls_index); node != NULL; node = next) {
+        next = node->next;
+        arch_slab_free(node, sizeof(arch_mcs_node));
+    }
+    TlsSetValue(libpthread_mcs_tls_index, NULL);
+}
+
+int arch_mcs_init(void)
+{
+    if ((libpthread_mcs_tls_index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+        return 0;
+
+    return 1;
+}
+
+void arch_mcs_fini(void)
+{
+    arch_mcs_thread_exit();
+    TlsFree(libpthread_mcs_tls_index);
+    libpthread_mcs_tls_index = TLS_OUT_OF_INDEXES;
+}
@@ -33,10 +33,11 @@
 
 #ifdef _MSC_VER
 #include <intrin.h>
-#pragma intrinsic(_InterlockedCompareExchange, _InterlockedDecrement, _InterlockedIncrement, _mm_pause)
+#pragma intrinsic(_InterlockedCompareExchange, _InterlockedDecrement, _InterlockedIncrement, _InterlockedExchange, _mm_pause, __rdtsc)
+#pragma intrinsic(_InterlockedCompareExchange64)
 
 #ifdef _WIN64
-#pragma intrinsic(_InterlockedCompareExchangePointer)
+#pragma intrinsic(_InterlockedCompareExchangePointer, _InterlockedExchangePointer)
 #endif
 #endif
 
@@ -239,6 +240,48 @@ static __inline long atomic_read(long volatile *__ptr)
     return *__ptr;
 }
 
+/* Loads after this one are not performed before it. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline long atomic_read_acquire(long volatile *__ptr)
+{
+#ifdef _MSC_VER
+    long value = *__ptr;
+    _ReadWriteBarrier();
+    return value;
+#else
+    return __atomic_load_n(__ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Loads and stores before this one are performed before it. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline void atomic_set_release(long volatile *__ptr, long value)
+{
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *__ptr = value;
+#else
+    __atomic_store_n(__ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+/* Loads before the fence are performed before loads after it. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline void atomic_fence_acquire(void)
+{
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
 #ifndef _MSC_VER
 __attribute__((always_inline))
 #endif
@@ -251,6 +294,19 @@ static __inline long atomic_fetch_and_add(long volatile *__ptr, long value)
 #endif
 }
 
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline long atomic_xchg(long volatile *__ptr, long value)
+{
+#ifdef _MSC_VER
+    return _InterlockedExchange(__ptr, value);
+#else
+    /* On x86 this is a full barrier xchg, not only an acquire barrier. */
+    return __sync_lock_test_and_set(__ptr, value);
+#endif
+}
+
 #ifndef _MSC_VER
 __attribute__((always_inline))
 #endif
@@ -268,6 +324,48 @@ static __inline long atomic_cmpxchg(long volatile *__ptr, long __new, long __old
 #endif
 }
 
+/* cmpxchg8b on 32-bit Windows, so Pentium or later. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline __int64 atomic_cmpxchg64(__int64 volatile *__ptr, __int64 __new, __int64 __old)
+{
+#ifdef _MSC_VER
+    return _InterlockedCompareExchange64(__ptr, __new, __old);
+#else
+    return __sync_val_compare_and_swap (__ptr, __old, __new);
+#endif
+}
+
+/* A 64-bit load that is never torn, also on 32-bit Windows. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline __int64 atomic_read64(__int64 volatile *__ptr)
+{
+#ifdef _WIN64
+    return *__ptr;
+#else
+    return atomic_cmpxchg64(__ptr, 0, 0);
+#endif
+}
+
+/* A 64-bit store that is never torn, also on 32-bit Windows. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline void atomic_set64(__int64 volatile *__ptr, __int64 value)
+{
+#ifdef _WIN64
+    *__ptr = value;
+#else
+    __int64 old = *__ptr, seen;
+
+    while ((seen = atomic_cmpxchg64(__ptr, value, old)) != old)
+        old = seen;
+#endif
+}
+
 #ifndef _MSC_VER
 __attribute__((always_inline))
 #endif
@@ -293,6 +391,35 @@ static __inline void *atomic_cmpxchg_ptr(void * volatile *__ptr, void *__new, vo
 #endif
 }
 
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline void *atomic_xchg_ptr(void * volatile *__ptr, void *value)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return _InterlockedExchangePointer(__ptr, value);
+#else
+    return (void *) _InterlockedExchange((volatile long *) __ptr, (long) value);
+#endif
+#else
+    return __sync_lock_test_and_set(__ptr, value);
+#endif
+}
+
+/* Return the time stamp counter, for cheap interval measurement. */
+#ifndef _MSC_VER
+__attribute__((always_inline))
+#endif
+static __inline unsigned __int64 arch_cycles(void)
+{
+#ifdef _MSC_VER
+    return __rdtsc();
+#else
+    return __builtin_ia32_rdtsc();
+#endif
+}
+
 static __inline int get_ncpu()
 {
     int n = 0;
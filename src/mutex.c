@@ -25,6 +25,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <winsock2.h>
 
@@ -40,7 +41,7 @@
  */
 int pthread_mutexattr_init(pthread_mutexattr_t *attr)
 {
-    arch_mutex_attr *pv = calloc(1, sizeof(arch_mutex_attr));
+    arch_mutex_attr *pv = arch_slab_alloc(sizeof(arch_mutex_attr));
     if (pv == NULL)
         return ENOMEM;
 
@@ -62,7 +63,7 @@ int pthread_mutexattr_init(pthread_mutexattr_t *attr)
  */
 int pthread_mutexattr_getrobust(const pthread_mutexattr_t *attr, int *robust)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     *robust = pv->robust;
     return 0;
 }
@@ -76,7 +77,7 @@ int pthread_mutexattr_getrobust(const pthread_mutexattr_t *attr, int *robust)
  */
 int pthread_mutexattr_setrobust(pthread_mutexattr_t *attr, int robust)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     pv->robust = robust;
     return 0;
 }
@@ -90,7 +91,7 @@ int pthread_mutexattr_setrobust(pthread_mutexattr_t *attr, int robust)
  */
 int pthread_mutexattr_gettype(const pthread_mutexattr_t *attr, int *type)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     *type = pv->type;
     return 0;
 }
@@ -99,12 +100,24 @@ int pthread_mutexattr_gettype(const pthread_mutexattr_t *attr, int *type)
  * Set the mutex type attribute.
  * @param attr The pointer of the mutex attribute object.
  * @param type The mutex type.
- * @return Always return 0.
- * @remark This function is provided for source code compatibility but no effect when called.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ * @remark PTHREAD_MUTEX_RECURSIVE and PTHREAD_MUTEX_ERRORCHECK mutexes
+ *         record their owning thread, PTHREAD_MUTEX_NORMAL ones do not.
+ * @remark PTHREAD_MUTEX_ADAPTIVE_NP mutexes learn their own spin count
+ *         from how often spinning acquired the lock recently.
+ * @remark PTHREAD_MUTEX_HANDOFF_NP mutexes let newcomers barge like
+ *         PTHREAD_MUTEX_NORMAL ones, until a waiter has been blocked for
+ *         more than a millisecond. From then on, unlock hands the lock to
+ *         the longest waiter directly, which bounds the worst-case wait.
  */
 int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int type)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
+
+    if (type < PTHREAD_MUTEX_NORMAL || type > PTHREAD_MUTEX_HANDOFF_NP)
+        return EINVAL;
+
     pv->type = type;
     return 0;
 }
@@ -114,12 +127,10 @@ int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int type)
  * @param attr The pointer of the mutex attribute object.
  * @param pshared The process-shared attribute.
  * @return Always return 0.
- * @remark The only type we support is PTHREAD_PROCESS_PRIVATE.
- * @remark This function is provided for source code compatibility but no effect when called.
  */
 int pthread_mutexattr_getpshared(const pthread_mutexattr_t *attr, int *pshared)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     *pshared = pv->pshared;
     return 0;
 }
@@ -128,13 +139,19 @@ int pthread_mutexattr_getpshared(const pthread_mutexattr_t *attr, int *pshared)
  * Set the mutex process-shared attribute.
  * @param attr The pointer of the mutex attribute object.
  * @param pshared The process-shared attribute.
- * @return Always return 0.
- * @remark The only type we support is PTHREAD_PROCESS_PRIVATE.
- * @remark This function is provided for source code compatibility but no effect when called.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ * @remark PTHREAD_PROCESS_SHARED is only supported when the library is built
+ *         with LIBPTHREAD_INLINE_MUTEX, otherwise pthread_mutex_init() fails
+ *         with ENOTSUP.
  */
 int pthread_mutexattr_setpshared(pthread_mutexattr_t *attr, int pshared)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
+
+    if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED)
+        return EINVAL;
+
     pv->pshared = pshared;
     return 0;
 }
@@ -148,7 +165,7 @@ int pthread_mutexattr_setpshared(pthread_mutexattr_t *attr, int pshared)
  */
 int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *attr, int *protocol)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     *protocol = pv->protocol;
     return 0;
 }
@@ -162,7 +179,7 @@ int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *attr, int *protocol
  */
 int pthread_mutexattr_setprotocol(pthread_mutexattr_t *attr, int protocol)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     pv->protocol = protocol;
     return 0;
 }
@@ -176,7 +193,7 @@ int pthread_mutexattr_setprotocol(pthread_mutexattr_t *attr, int protocol)
  */
 int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *attr, int *prioceiling)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     *prioceiling = pv->prioceiling;
     return 0;
 }
@@ -190,7 +207,7 @@ int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *attr, int *prioc
  */
 int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *attr, int prioceiling)
 {
-    arch_mutex_attr *pv = (arch_mutex_attr *) attr;
+    arch_mutex_attr *pv = (arch_mutex_attr *) *attr;
     pv->prioceiling = prioceiling;
     return 0;
 }
@@ -204,22 +221,213 @@ int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *attr, int prioceiling)
 int pthread_mutexattr_destroy(pthread_mutexattr_t *attr)
 {
     if (attr != NULL) {
-        free(*attr);
+        arch_slab_free(*attr, sizeof(arch_mutex_attr));
         *attr = NULL;
     }
 
     return 0;
 }
 
-static int arch_mutex_init(pthread_mutex_t *m, int lock)
+/* Bounds of the learned spin budget of PTHREAD_MUTEX_ADAPTIVE_NP. */
+#define ARCH_MUTEX_SPIN_MIN     4
+#define ARCH_MUTEX_SPIN_MAX     1024
+
+/* Wait time after which a PTHREAD_MUTEX_HANDOFF_NP waiter is starving. */
+#define ARCH_MUTEX_STARVE_MS    1
+
+static long libpthread_mutex_spin = -1;
+static __int64 libpthread_mutex_starve_ticks;
+
+static __inline long arch_mutex_default_spin(void)
 {
-    int cpu_count = get_ncpu();
-    arch_mutex *pv = calloc(1, sizeof(arch_mutex));
-    if (pv == NULL)
+    /* see test_speed, about 1/2 the system call*/
+    if (libpthread_mutex_spin < 0)
+        libpthread_mutex_spin = get_ncpu() > 1 ? 32 : 0;
+
+    return libpthread_mutex_spin;
+}
+
+static __inline __int64 arch_mutex_ticks(void)
+{
+    LARGE_INTEGER t;
+
+    if (libpthread_mutex_starve_ticks == 0) {
+        QueryPerformanceFrequency(&t);
+        libpthread_mutex_starve_ticks = t.QuadPart * ARCH_MUTEX_STARVE_MS / 1000;
+    }
+
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+#ifdef LIBPTHREAD_INLINE_MUTEX
+
+/* The mutex lives in the caller's storage, see PTHREAD_MUTEX_INITIALIZER. */
+#define arch_mutex_of(m)    ((arch_mutex *) (m))
+
+/*
+ * WaitOnAddress() only works within a process, so process-shared mutexes
+ * block on a named semaphore instead, whose name is derived from an id kept
+ * in the mutex itself. The lock word protocol is unchanged: a semaphore
+ * count stands for a wakeup, so a wakeup posted before the waiter sleeps
+ * is not lost. Each process caches its own handle to the semaphore.
+ */
+#define ARCH_MUTEX_SHARED_CACHE 64 /* must be power of 2 */
+
+typedef struct arch_mutex_shared {
+    struct arch_mutex_shared *next;
+    long pid, serial;
+    HANDLE handle;
+} arch_mutex_shared;
+
+static pthread_spinlock_t libpthread_mutex_shared_lock = PTHREAD_SPINLOCK_INITIALIZER;
+static arch_mutex_shared *libpthread_mutex_shared[ARCH_MUTEX_SHARED_CACHE];
+static long libpthread_mutex_shared_serial;
+
+static __inline arch_mutex_shared *arch_mutex_shared_find(arch_mutex_shared *e, arch_mutex *pv)
+{
+    while (e != NULL && (e->pid != pv->shared_pid || e->serial != pv->shared_serial))
+        e = e->next;
+
+    return e;
+}
+
+/*
+ * Open the wait semaphore, creating it if no process has it open, in the
+ * namespace pthread_mutex_init() chose and recorded in shared_serial, so
+ * that every process sharing the mutex uses the same one.
+ */
+static HANDLE arch_mutex_shared_create(arch_mutex *pv)
+{
+    char name[64];
+    HANDLE handle;
+
+    sprintf(name, "%slibpthread-mutex-%lx-%lx",
+        (pv->shared_serial & ARCH_MUTEX_SHARED_LOCAL) ? "Local\\" : "Global\\",
+        pv->shared_pid, pv->shared_serial);
+    if ((handle = OpenSemaphoreA(SEMAPHORE_ALL_ACCESS, FALSE, name)) != NULL)
+        return handle;
+
+    return CreateSemaphoreA(NULL, 0, LONG_MAX, name);
+}
+
+static HANDLE arch_mutex_shared_handle(arch_mutex *pv)
+{
+    HANDLE handle;
+    arch_mutex_shared *e, *found;
+    arch_mutex_shared **bucket = libpthread_mutex_shared + (pv->shared_serial & (ARCH_MUTEX_SHARED_CACHE - 1));
+
+    pthread_spin_lock(& libpthread_mutex_shared_lock);
+    e = arch_mutex_shared_find(*bucket, pv);
+    pthread_spin_unlock(& libpthread_mutex_shared_lock);
+    if (e != NULL)
+        return e->handle;
+
+    /* Created first, so GetLastError() still tells why on failure. */
+    if ((handle = arch_mutex_shared_create(pv)) == NULL)
+        return NULL;
+
+    if ((e = arch_slab_alloc(sizeof(arch_mutex_shared))) == NULL) {
+        CloseHandle(handle);
+        return NULL;
+    }
+    e->handle = handle;
+    e->pid = pv->shared_pid;
+    e->serial = pv->shared_serial;
+
+    pthread_spin_lock(& libpthread_mutex_shared_lock);
+    if ((found = arch_mutex_shared_find(*bucket, pv)) == NULL) {
+        e->next = *bucket;
+        *bucket = e;
+    }
+    pthread_spin_unlock(& libpthread_mutex_shared_lock);
+
+    if (found != NULL) {
+        CloseHandle(e->handle);
+        arch_slab_free(e, sizeof(arch_mutex_shared));
+        return found->handle;
+    }
+
+    return e->handle;
+}
+
+static void arch_mutex_shared_close(arch_mutex *pv)
+{
+    arch_mutex_shared *e, **prev = libpthread_mutex_shared + (pv->shared_serial & (ARCH_MUTEX_SHARED_CACHE - 1));
+
+    pthread_spin_lock(& libpthread_mutex_shared_lock);
+    for (e = *prev; e != NULL; prev = & e->next, e = e->next) {
+        if (e->pid == pv->shared_pid && e->serial == pv->shared_serial) {
+            *prev = e->next;
+            break;
+        }
+    }
+    pthread_spin_unlock(& libpthread_mutex_shared_lock);
+
+    if (e != NULL) {
+        CloseHandle(e->handle);
+        arch_slab_free(e, sizeof(arch_mutex_shared));
+    }
+}
+
+static int arch_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *a)
+{
+    long serial;
+    HANDLE handle;
+    arch_mutex *pv = (arch_mutex *) m;
+
+    memset(m, 0, sizeof(pthread_mutex_t));
+    if (a != NULL && *a != NULL) {
+        pv->type = ((arch_mutex_attr *) *a)->type;
+
+        if (((arch_mutex_attr *) *a)->pshared == PTHREAD_PROCESS_SHARED) {
+            /* Seed from the clock, so a recycled process id gets new names. */
+            if (libpthread_mutex_shared_serial == 0)
+                atomic_cmpxchg(& libpthread_mutex_shared_serial, (long) (GetTickCount() << 12), 0);
+            while ((serial = atomic_fetch_and_add(& libpthread_mutex_shared_serial, 2) + 2) == 0)
+                ;
+            pv->shared_pid = (long) GetCurrentProcessId();
+            pv->shared_serial = serial & ~ARCH_MUTEX_SHARED_LOCAL;
+
+            /*
+             * Pick the namespace of the wait semaphore once, here: the
+             * global one, or the session one if we may not create objects
+             * there, in which case only processes of this session can
+             * share the mutex.
+             */
+            handle = arch_mutex_shared_handle(pv);
+            if (handle == NULL && GetLastError() == ERROR_ACCESS_DENIED) {
+                pv->shared_serial |= ARCH_MUTEX_SHARED_LOCAL;
+                handle = arch_mutex_shared_handle(pv);
+            }
+            if (handle == NULL) {
+                memset(m, 0, sizeof(pthread_mutex_t));
+                return EAGAIN;
+            }
+        }
+    }
+    pv->spin_count = arch_mutex_default_spin();
+
+    return 0;
+}
+
+#else
+
+#define arch_mutex_of(m)    ((arch_mutex *) *(m))
+
+static int arch_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *a, int lock)
+{
+    arch_mutex *pv;
+
+    if (a != NULL && *a != NULL && ((arch_mutex_attr *) *a)->pshared == PTHREAD_PROCESS_SHARED)
+        return ENOTSUP;
+
+    if ((pv = arch_slab_alloc(sizeof(arch_mutex))) == NULL)
         return ENOMEM;
 
-    /* see test_speed, about 1/2 the system call*/
-    if (cpu_count > 1) pv->spin_count = 32;
+    if (a != NULL && *a != NULL)
+        pv->type = ((arch_mutex_attr *) *a)->type;
+    pv->spin_count = arch_mutex_default_spin();
 
     if (!lock) {
         *m = pv;
@@ -227,18 +435,171 @@ static int arch_mutex_init(pthread_mutex_t *m, int lock)
     }
 
     if (atomic_cmpxchg_ptr(m, pv, NULL) != NULL) {
-        free(pv);
+        arch_slab_free(pv, sizeof(arch_mutex));
     }
 
     return 0;
 }
 
-static __inline int spin_lock_with_count(volatile long *lock, int count)
+#endif
+
+#ifdef LIBPTHREAD_LOCKSTAT
+
+/*
+ * Contention statistics. Every counter except the two updated on failure
+ * paths is written only by the thread holding the mutex, so the hot path
+ * pays for one time stamp read on lock and one on unlock, and no atomics.
+ */
+static arch_mutex_stat *libpthread_lockstat_list;
+static pthread_spinlock_t libpthread_lockstat_lock = PTHREAD_SPINLOCK_INITIALIZER;
+
+#define arch_mutex_stat_clock()     arch_cycles()
+
+static arch_mutex_stat *arch_mutex_stat_of(pthread_mutex_t *m, arch_mutex *pv)
+{
+    arch_mutex_stat *st = pv->stat;
+
+    /* The record is process-local, a shared mutex has nowhere to keep it. */
+    if (st != NULL || pv->shared_serial != 0)
+        return st;
+
+    if ((st = arch_slab_alloc(sizeof(arch_mutex_stat))) == NULL)
+        return NULL;
+    st->mutex = m;
+    st->pv = pv;
+
+    if (atomic_cmpxchg_ptr((void * volatile *) & pv->stat, st, NULL) != NULL) {
+        arch_slab_free(st, sizeof(arch_mutex_stat));
+        return pv->stat;
+    }
+
+    pthread_spin_lock(& libpthread_lockstat_lock);
+    st->next = libpthread_lockstat_list;
+    if (st->next != NULL)
+        st->next->prev = st;
+    libpthread_lockstat_list = st;
+    pthread_spin_unlock(& libpthread_lockstat_lock);
+
+    return st;
+}
+
+static void arch_mutex_stat_detach(arch_mutex *pv)
+{
+    arch_mutex_stat *st = pv->stat;
+
+    if (st == NULL)
+        return;
+
+    pthread_spin_lock(& libpthread_lockstat_lock);
+    if (st->prev != NULL) st->prev->next = st->next;
+    else libpthread_lockstat_list = st->next;
+    if (st->next != NULL) st->next->prev = st->prev;
+    pthread_spin_unlock(& libpthread_lockstat_lock);
+
+    pv->stat = NULL;
+    arch_slab_free(st, sizeof(arch_mutex_stat));
+}
+
+/* Called with the mutex held, start is 0 for an uncontended acquisition. */
+static __inline void arch_mutex_stat_acquired(pthread_mutex_t *m, arch_mutex *pv,
+    unsigned __int64 start, long sleeps)
+{
+    unsigned __int64 now = arch_cycles(), wait;
+    arch_mutex_stat *st = pv->stat;
+
+    if (st == NULL && (st = arch_mutex_stat_of(m, pv)) == NULL)
+        return;
+
+    st->acquisitions++;
+    st->acquired_at = now;
+    if (start == 0)
+        return;
+
+    wait = now - start;
+    st->wait_cycles += wait;
+    if (wait > st->max_wait_cycles)
+        st->max_wait_cycles = wait;
+    if (sleeps == 0)
+        st->spin_acquisitions++;
+    else
+        st->kernel_waits += sleeps;
+}
+
+/* Called with the mutex held, before it is released. */
+static __inline void arch_mutex_stat_released(arch_mutex *pv)
+{
+    arch_mutex_stat *st = pv->stat;
+
+    if (st != NULL)
+        st->hold_cycles += arch_cycles() - st->acquired_at;
+}
+
+static __inline void arch_mutex_stat_trylock_failed(arch_mutex *pv)
+{
+    if (pv->stat != NULL)
+        (void) atomic_fetch_and_add(& pv->stat->trylock_failures, 1);
+}
+
+static __inline void arch_mutex_stat_timeout(arch_mutex *pv)
+{
+    if (pv->stat != NULL)
+        (void) atomic_fetch_and_add(& pv->stat->timeouts, 1);
+}
+
+static __inline void arch_mutex_stat_polled(arch_mutex *pv)
+{
+    if (pv->stat != NULL)
+        (void) atomic_fetch_and_add(& pv->stat->polled_waits, 1);
+}
+
+#else
+
+#define arch_mutex_stat_clock()                     0
+#define arch_mutex_stat_acquired(m, pv, start, n)   ((void) (start))
+#define arch_mutex_stat_released(pv)                ((void) 0)
+#define arch_mutex_stat_trylock_failed(pv)          ((void) 0)
+#define arch_mutex_stat_timeout(pv)                 ((void) 0)
+#define arch_mutex_stat_polled(pv)                  ((void) 0)
+
+#endif /* LIBPTHREAD_LOCKSTAT */
+
+/* How far a thread in the slow path of pthread_mutex_lock has got. */
+#define ARCH_MUTEX_NEW      0 /* not counted as a sleeper */
+#define ARCH_MUTEX_WOKEN    1 /* counted as a sleeper, has slept */
+#define ARCH_MUTEX_STARVED  2 /* as above, for longer than ARCH_MUTEX_STARVE_MS */
+
+/*
+ * Take the lock if it is free, keeping the waiter bits. A thread that has
+ * come back from sleep is still counted as a waiter and clears the wake
+ * pending bit, both in the same CAS that takes the lock. It also claims a
+ * lock handed off by the unlocking thread.
+ */
+static __inline int arch_mutex_try_acquire(volatile long *lock, int awoke)
+{
+    long v = atomic_read(lock), nv;
+
+    if ((v & ARCH_MUTEX_LOCKED) == 0) {
+        nv = v | ARCH_MUTEX_LOCKED;
+        if (awoke)
+            nv = (nv - ARCH_MUTEX_WAITER) & ~ARCH_MUTEX_WAKING;
+    } else if (awoke && (v & ARCH_MUTEX_HANDOFF)) {
+        /* Leave starvation mode once the queue is short again, as in Go. */
+        nv = (v - ARCH_MUTEX_WAITER) & ~(ARCH_MUTEX_HANDOFF | ARCH_MUTEX_WAKING);
+        if (awoke != ARCH_MUTEX_STARVED || nv < ARCH_MUTEX_WAITER)
+            nv &= ~ARCH_MUTEX_STARVING;
+    } else {
+        return 0;
+    }
+
+    return atomic_cmpxchg(lock, nv, v) == v;
+}
+
+static __inline int spin_lock_with_count(volatile long *lock, int count, int awoke)
 {
     int i = 0;
 
     do {
-        if (atomic_cmpxchg((volatile long *) lock, 1, 0) == 0)
+        if (arch_mutex_try_acquire(lock, awoke))
             return 1;
         cpu_relax();
     } while(++i < count);
@@ -246,24 +607,120 @@ static __inline int spin_lock_with_count(volatile long *lock, int count)
     return 0;
 }
 
-static __inline void spin_unlock(volatile long *lock)
+/*
+ * Spin for at most the learned budget. If the lock was acquired late in
+ * the budget, the budget grows; if spinning failed, it shrinks, so short
+ * critical sections converge to spinning and long ones to blocking.
+ */
+static int spin_lock_adaptive(arch_mutex *pv, int awoke)
 {
-    *lock = 0;
+    long i, budget = pv->spin_count;
+
+    if (arch_mutex_try_acquire(& pv->lock_status, awoke))
+        return 1;
+
+    if (budget == 0) /* uniprocessor, spinning never helps */
+        return 0;
+
+    for (i = 1; i < budget; i++) {
+        cpu_relax();
+        if (arch_mutex_try_acquire(& pv->lock_status, awoke)) {
+            budget += (2 * i - budget) / 8;
+            if (budget > ARCH_MUTEX_SPIN_MAX) budget = ARCH_MUTEX_SPIN_MAX;
+            if (budget < ARCH_MUTEX_SPIN_MIN) budget = ARCH_MUTEX_SPIN_MIN;
+            pv->spin_count = budget;
+            return 1;
+        }
+    }
+
+    budget -= budget / 8 + 1;
+    if (budget < ARCH_MUTEX_SPIN_MIN) budget = ARCH_MUTEX_SPIN_MIN;
+    pv->spin_count = budget;
+
+    return 0;
 }
 
-static __inline void arch_mutex_init_handle(HANDLE *sync)
+static __inline void arch_mutex_sleep(arch_mutex *pv, long compare, DWORD ms)
 {
+#ifdef LIBPTHREAD_INLINE_MUTEX
     HANDLE handle;
 
-    while (*sync == NULL) {
-        handle = CreateEvent(NULL, FALSE, FALSE, NULL);
-        if (handle != NULL) {
-            if (atomic_cmpxchg_ptr(sync, handle, NULL) != NULL)
-                (void) CloseHandle(handle);
-            return;
+    if (pv->shared_serial != 0) {
+        /* Without the wait semaphore, poll as a last resort. */
+        if ((handle = arch_mutex_shared_handle(pv)) != NULL) {
+            (void) WaitForSingleObject(handle, ms);
         } else {
-            (void) SleepEx(1000, TRUE); /* Waiting for resources available */
+            arch_mutex_stat_polled(pv);
+            Sleep(1);
+        }
+        return;
+    }
+#endif
+
+    (void) arch_wait_on_address(& pv->lock_status, compare, ms);
+}
+
+/*
+ * Condition waiters requeued by arch_mutex_requeue() are counted as
+ * sleepers too, and are woken first, on their own state word, but only
+ * ARCH_MUTEX_MORPH_BURST times in a row when threads also sleep on the
+ * lock word, so that a steady stream of broadcasts cannot starve them.
+ * The counted sleepers that are not on the morph list sleep on the word.
+ */
+static __inline void arch_mutex_wake_one(arch_mutex *pv)
+{
+    arch_cond_waiter *node;
+#ifdef LIBPTHREAD_INLINE_MUTEX
+    HANDLE handle;
+
+    if (pv->shared_serial != 0) {
+        if ((handle = arch_mutex_shared_handle(pv)) != NULL)
+            ReleaseSemaphore(handle, 1, NULL);
+        return;
+    }
+#endif
+
+    if (pv->morph_head != NULL) {
+        pthread_spin_lock(& pv->morph_lock);
+        if ((node = pv->morph_head) != NULL) {
+            if ((pv->morph & ARCH_MUTEX_MORPH_RUN) >= ARCH_MUTEX_MORPH_BURST
+                && atomic_read(& pv->lock_status) / ARCH_MUTEX_WAITER > pv->morph / ARCH_MUTEX_MORPH_NODE) {
+                pv->morph &= ~ARCH_MUTEX_MORPH_RUN;
+                node = NULL;
+            } else {
+                pv->morph_head = node->next;
+                if (pv->morph_head == NULL)
+                    pv->morph_tail = NULL;
+                pv->morph += 1 - ARCH_MUTEX_MORPH_NODE;
+            }
+        }
+        pthread_spin_unlock(& pv->morph_lock);
+
+        if (node != NULL) {
+            /* The node may be gone once its state changes, wake by address only. */
+            atomic_set(& node->state, ARCH_COND_WOKEN);
+            arch_wake_by_address(& node->state, 1);
+            return;
+        }
+    }
+
+    arch_wake_by_address(& pv->lock_status, 1);
+}
+
+/*
+ * Wake one sleeper if the lock is free, there are sleepers, and no wakeup
+ * is already in flight. v is the last known value of the lock word.
+ */
+static void arch_mutex_wake(arch_mutex *pv, long v)
+{
+    long old;
+
+    while (v >= ARCH_MUTEX_WAITER && (v & (ARCH_MUTEX_LOCKED | ARCH_MUTEX_WAKING)) == 0) {
+        if ((old = atomic_cmpxchg(& pv->lock_status, v | ARCH_MUTEX_WAKING, v)) == v) {
+            arch_mutex_wake_one(pv);
+            return;
         }
+        v = old;
     }
 }
 
@@ -273,14 +730,18 @@ static __inline void arch_mutex_init_handle(HANDLE *sync)
  * @param a The pointer of the mutex attribute object.
  * @return If the function succeeds, the return value is 0.
  *         If the function fails, the return value is -1,
- *         with errno set to indicate the error (ENOMEM).
- * @remark We provide pthread_mutexattr_* functions only for compatibility,
- *         please use pthread_mutex_init(&mutex, NULL) for new applications.
+ *         with errno set to indicate the error (ENOMEM, or EAGAIN if the
+ *         wait semaphore of a process-shared mutex cannot be created).
+ * @remark Only the type attribute is honored, see pthread_mutexattr_settype().
  */
 int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *a)
 {
+#ifdef LIBPTHREAD_INLINE_MUTEX
+    return arch_mutex_init(m, a);
+#else
     *m = NULL;
-    return arch_mutex_init(m, 0);
+    return arch_mutex_init(m, a, 0);
+#endif
 }
 
 /**
@@ -321,70 +782,310 @@ int pthread_mutex_consistent(pthread_mutex_t *mutex)
     return 0;
 }
 
+/*
+ * Milliseconds to sleep before an absolute deadline, 0 if less than one
+ * millisecond remains (the caller spins it out), -1 if it has passed.
+ */
+static __inline long arch_mutex_wait_ms(const struct timespec *abs_timeout, DWORD *ms)
+{
+    __int64 rel;
+
+    if (abs_timeout == NULL) {
+        *ms = INFINITE;
+        return 1;
+    }
+
+    if ((rel = arch_rel_time_in_100ns(abs_timeout)) <= 0)
+        return -1;
+
+    rel /= POW10_4;
+    *ms = rel >= MAX_SLEEP_IN_MS ? MAX_SLEEP_IN_MS : (DWORD) rel;
+    return *ms > 0;
+}
+
+/*
+ * A woken waiter giving up: stop counting ourselves and drop the wake
+ * pending bit, then pass the wakeup on if the lock is free, otherwise it
+ * would be lost for the remaining sleepers. A lock handed off to us
+ * meanwhile is taken instead, returning 1, as nobody else would take it.
+ */
+static int arch_mutex_leave(arch_mutex *pv, int awoke)
+{
+    long v = atomic_read(& pv->lock_status), nv, old;
+
+    while (1) {
+        if (v & ARCH_MUTEX_HANDOFF) {
+            if (arch_mutex_try_acquire(& pv->lock_status, awoke))
+                return 1;
+            v = atomic_read(& pv->lock_status);
+            continue;
+        }
+
+        nv = (v - ARCH_MUTEX_WAITER) & ~ARCH_MUTEX_WAKING;
+        if ((old = atomic_cmpxchg(& pv->lock_status, nv, v)) == v)
+            break;
+        v = old;
+    }
+
+    arch_mutex_wake(pv, nv);
+    return 0;
+}
+
+static int arch_mutex_lock_wait(arch_mutex *pv, const struct timespec *abs_timeout, long *sleeps, int awoke)
+{
+    long rc, v, nv = 0, old, spins;
+    __int64 start = 0;
+    DWORD ms;
+
+    /* Statically initialized inline mutexes start with no spin count. */
+    if (pv->spin_count == 0)
+        pv->spin_count = arch_mutex_default_spin();
+
+    /* A requeued condition waiter has waited since it was woken. */
+    if (pv->type == PTHREAD_MUTEX_HANDOFF_NP && awoke != ARCH_MUTEX_NEW)
+        start = arch_mutex_ticks();
+
+    while(1) {
+        /*
+         * Always try the lock before looking at the clock: a waiter that
+         * was woken must not leave the lock free and give up, or the wakeup
+         * meant for the next waiter would be lost.
+         */
+        if (pv->type == PTHREAD_MUTEX_ADAPTIVE_NP) {
+            if (spin_lock_adaptive(pv, awoke))
+                return 0;
+        } else {
+            /* Spinning is futile while the lock is being handed off. */
+            spins = (atomic_read(& pv->lock_status) & ARCH_MUTEX_STARVING) ? 1 : pv->spin_count;
+            if (spin_lock_with_count(& pv->lock_status, spins, awoke))
+                return 0;
+        }
+
+        if ((rc = arch_mutex_wait_ms(abs_timeout, &ms)) < 0) {
+            if (awoke && arch_mutex_leave(pv, awoke))
+                return 0;
+            return ETIMEDOUT;
+        }
+
+        if (rc == 0) {
+            /* Less than a millisecond left, don't let the kernel round it. */
+            SwitchToThread();
+            continue;
+        }
+
+        /*
+         * Count ourselves as a sleeper, or once woken, drop the wake
+         * pending bit so the next unlock may wake someone again. A starved
+         * waiter switches the mutex to hand-off. The lock word is only
+         * touched when it is still held and not handed to us.
+         */
+        for (v = atomic_read(& pv->lock_status); v & ARCH_MUTEX_LOCKED; v = old) {
+            if (awoke && (v & ARCH_MUTEX_HANDOFF))
+                break;
+            nv = awoke ? v & ~ARCH_MUTEX_WAKING : v + ARCH_MUTEX_WAITER;
+            if (awoke == ARCH_MUTEX_STARVED)
+                nv |= ARCH_MUTEX_STARVING;
+            if (nv == v || (old = atomic_cmpxchg(& pv->lock_status, nv, v)) == v)
+                break;
+        }
+
+        if ((v & ARCH_MUTEX_LOCKED) == 0 || (awoke && (v & ARCH_MUTEX_HANDOFF)))
+            continue;
+
+        if (pv->type == PTHREAD_MUTEX_HANDOFF_NP && awoke == ARCH_MUTEX_NEW)
+            start = arch_mutex_ticks();
+
+        /* Sleep keyed on the lock word, no per-mutex kernel object. */
+        arch_mutex_sleep(pv, nv, ms);
+        (*sleeps)++;
+
+        if (pv->type == PTHREAD_MUTEX_HANDOFF_NP
+            && arch_mutex_ticks() - start > libpthread_mutex_starve_ticks)
+            awoke = ARCH_MUTEX_STARVED;
+        else if (awoke == ARCH_MUTEX_NEW)
+            awoke = ARCH_MUTEX_WOKEN;
+    }
+
+    return 0;
+}
+
+static int arch_mutex_lock_slow(pthread_mutex_t *m, arch_mutex *pv, const struct timespec *abs_timeout)
+{
+    int rc;
+    long sleeps = 0;
+    unsigned __int64 start = arch_mutex_stat_clock();
+
+    if ((rc = arch_mutex_lock_wait(pv, abs_timeout, &sleeps, ARCH_MUTEX_NEW)) == 0)
+        arch_mutex_stat_acquired(m, pv, start, sleeps);
+    else
+        arch_mutex_stat_timeout(pv);
+
+    return rc;
+}
+
+/*
+ * Release a PTHREAD_MUTEX_HANDOFF_NP mutex. In starvation mode the lock
+ * stays held and ownership passes to whichever sleeper is woken.
+ */
+static int arch_mutex_unlock_handoff(arch_mutex *pv)
+{
+    long v = atomic_read(& pv->lock_status), nv, old;
+
+    while (1) {
+        if ((v & ARCH_MUTEX_LOCKED) == 0)
+            return EPERM;
+        if ((v & ARCH_MUTEX_STARVING) == 0)
+            nv = v & ~ARCH_MUTEX_LOCKED;
+        else if (v >= ARCH_MUTEX_WAITER)
+            nv = v | ARCH_MUTEX_HANDOFF;
+        else
+            nv = v & ~(ARCH_MUTEX_LOCKED | ARCH_MUTEX_STARVING);
+
+        if ((old = atomic_cmpxchg(& pv->lock_status, nv, v)) == v)
+            break;
+        v = old;
+    }
+
+    if (nv & ARCH_MUTEX_HANDOFF)
+        arch_mutex_wake_one(pv);
+    else if (nv != 0)
+        arch_mutex_wake(pv, nv);
+
+    return 0;
+}
+
+/* RECURSIVE and ERRORCHECK mutexes record their owner, NORMAL ones do not. */
+#define arch_mutex_is_owned(pv) \
+    ((pv)->type == PTHREAD_MUTEX_RECURSIVE || (pv)->type == PTHREAD_MUTEX_ERRORCHECK)
+
+static int arch_mutex_lock_owned(pthread_mutex_t *m, arch_mutex *pv, const struct timespec *abs_timeout, int try)
+{
+    int rc;
+    long self = (long) GetCurrentThreadId();
+
+    if (pv->owner == self) {
+        if (pv->type == PTHREAD_MUTEX_ERRORCHECK)
+            return try ? EBUSY : EDEADLK;
+        if (pv->count == LONG_MAX)
+            return EAGAIN;
+        pv->count++;
+        return 0;
+    }
+
+    if (atomic_cmpxchg(& pv->lock_status, 1, 0) == 0) {
+        arch_mutex_stat_acquired(m, pv, 0, 0);
+    } else if (try) {
+        arch_mutex_stat_trylock_failed(pv);
+        return EBUSY;
+    } else if ((rc = arch_mutex_lock_slow(m, pv, abs_timeout)) != 0) {
+        return rc;
+    }
+
+    /* The only extra cost of an uncontended owned lock. */
+    pv->owner = self;
+    return 0;
+}
+
 /**
  * Acquire a mutex lock.
  * @param m The pointer of the mutex object.
  * @return If the function succeeds, the return value is 0.
- *         If the function fails, the return value is -1,
- *         with errno set to indicate the error (ENOMEM, EDEADLK).
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EAGAIN, or EDEADLK).
  */
 int pthread_mutex_lock(pthread_mutex_t *m)
 {
     arch_mutex *pv;
 
+#ifndef LIBPTHREAD_INLINE_MUTEX
     if (*m == NULL) {
-        int rc = arch_mutex_init(m, 1);
+        int rc = arch_mutex_init(m, NULL, 1);
         if (rc != 0) return rc;
     }
+#endif
 
-    pv = (arch_mutex *) *m;
+    pv = arch_mutex_of(m);
 
-    while(1) {
-        if (spin_lock_with_count(& pv->lock_status, pv->spin_count)) {
-            /* pv->thread_id = GetCurrentThreadId(); */
-            return 0;
-        }
+    if (arch_mutex_is_owned(pv))
+        return arch_mutex_lock_owned(m, pv, NULL, 0);
+
+    if (atomic_cmpxchg(& pv->lock_status, 1, 0) == 0) {
+        arch_mutex_stat_acquired(m, pv, 0, 0);
+        return 0;
+    }
 
-        if (pv->sync == NULL)
-            arch_mutex_init_handle(& pv->sync);
+    return arch_mutex_lock_slow(m, pv, NULL);
+}
 
-        (void) atomic_fetch_and_add(& pv->wait, 1);
-        /* Small probability event, but we must examine it. */
-        if (atomic_cmpxchg((volatile long *) & pv->lock_status, 1, 0) == 0) {
-            /* pv->thread_id = GetCurrentThreadId(); */
-            (void) atomic_fetch_and_add(& pv->wait, -1);
-            return 0;
-        }
-        (void) WaitForSingleObject(pv->sync, INFINITE);
-        (void) atomic_fetch_and_add(& pv->wait, -1);
+/**
+ * Acquire a mutex lock, or give up at an absolute deadline.
+ * @param m The pointer of the mutex object.
+ * @param abs_timeout The pointer of the structure that specifies an
+ *        absolute timeout in seconds and nanoseconds since the Epoch,
+ *        1970-01-01 00:00:00 +0000 (UTC).
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EINVAL, EAGAIN, EDEADLK or ETIMEDOUT).
+ * @remark The deadline is kept in 100-nanoseconds: whole milliseconds are
+ *         slept in the kernel and the rest is spent yielding, so a deadline
+ *         is never rounded down to the millisecond.
+ */
+int pthread_mutex_timedlock(pthread_mutex_t *m, const struct timespec *abs_timeout)
+{
+    arch_mutex *pv;
+
+#ifndef LIBPTHREAD_INLINE_MUTEX
+    if (*m == NULL) {
+        int rc = arch_mutex_init(m, NULL, 1);
+        if (rc != 0) return rc;
     }
+#endif
 
-    return 0;
+    pv = arch_mutex_of(m);
+
+    if (!arch_mutex_is_owned(pv) && atomic_cmpxchg(& pv->lock_status, 1, 0) == 0) {
+        arch_mutex_stat_acquired(m, pv, 0, 0);
+        return 0;
+    }
+
+    if (abs_timeout == NULL || abs_timeout->tv_nsec < 0 || abs_timeout->tv_nsec >= POW10_9)
+        return EINVAL;
+
+    if (arch_mutex_is_owned(pv))
+        return arch_mutex_lock_owned(m, pv, abs_timeout, 0);
+
+    return arch_mutex_lock_slow(m, pv, abs_timeout);
 }
 
 /**
  * Try acquire a mutex lock.
  * @param m The pointer of the mutex object.
  * @return If the function succeeds, the return value is 0.
- *         If the function fails, the return value is -1,
- *         with errno set to indicate the error (ENOMEM or EBUSY).
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EAGAIN or EBUSY).
  */
 int pthread_mutex_trylock(pthread_mutex_t *m)
 {
     arch_mutex *pv;
 
+#ifndef LIBPTHREAD_INLINE_MUTEX
     if (*m == NULL) {
-        int rc = arch_mutex_init(m, 1);
+        int rc = arch_mutex_init(m, NULL, 1);
         if (rc != 0) return rc;
     }
+#endif
+
+    pv = arch_mutex_of(m);
 
-    pv = (arch_mutex *) *m;
+    if (arch_mutex_is_owned(pv))
+        return arch_mutex_lock_owned(m, pv, NULL, 1);
 
-    if (spin_lock_with_count(& pv->lock_status, pv->spin_count)) {
-        /* pv->thread_id = GetCurrentThreadId(); */
+    if (spin_lock_with_count(& pv->lock_status, pv->spin_count, 0)) {
+        arch_mutex_stat_acquired(m, pv, 0, 0);
         return 0;
     }
 
+    arch_mutex_stat_trylock_failed(pv);
     return EBUSY;
 }
 
@@ -392,21 +1093,129 @@ int pthread_mutex_trylock(pthread_mutex_t *m)
  * Release a mutex lock.
  * @param m The pointer of the mutex object.
  * @return If the function succeeds, the return value is 0.
- *         If the function fails, the return value is -1,
- *         with errno set to indicate the error (EINVAL).
+ *         Otherwise an error number will be returned to indicate the error
+ *         (EINVAL, or EPERM if a RECURSIVE or ERRORCHECK mutex is not
+ *         owned by the calling thread, or if the mutex is not locked).
  */
 int pthread_mutex_unlock(pthread_mutex_t *m)
 {
-    arch_mutex *pv = (arch_mutex *) *m;
-    if (pv != NULL) {
-        /* pv->thread_id = 0; */
-        atomic_set(& pv->lock_status, 0);
-        if (atomic_read(& pv->wait))
-            SetEvent(pv->sync);
-        return 0;
+    long v;
+    arch_mutex *pv = arch_mutex_of(m);
+#ifndef LIBPTHREAD_INLINE_MUTEX
+    if (pv == NULL)
+        return EINVAL;
+#endif
+
+    if (arch_mutex_is_owned(pv)) {
+        if (pv->owner != (long) GetCurrentThreadId())
+            return EPERM;
+        if (pv->count > 0) {
+            pv->count--;
+            return 0;
+        }
+        pv->owner = 0;
+    }
+
+    arch_mutex_stat_released(pv);
+
+    if (pv->type == PTHREAD_MUTEX_HANDOFF_NP)
+        return arch_mutex_unlock_handoff(pv);
+
+    /* One interlocked operation releases the lock and reads the waiters. */
+    v = atomic_fetch_and_add(& pv->lock_status, -ARCH_MUTEX_LOCKED) - ARCH_MUTEX_LOCKED;
+    if (((v + ARCH_MUTEX_LOCKED) & ARCH_MUTEX_LOCKED) == 0) {
+        /* It was not locked, put the word back rather than wedge the mutex. */
+        atomic_fetch_and_add(& pv->lock_status, ARCH_MUTEX_LOCKED);
+        return EPERM;
+    }
+    if (v != 0)
+        arch_mutex_wake(pv, v);
+
+    return 0;
+}
+
+/**
+ * Check that pthread_mutex_unlock() would succeed, before a condition
+ * waiter commits to waiting.
+ * @param m The pointer of the mutex object.
+ * @param pv Receives the internal mutex object.
+ * @return 0, EINVAL or EPERM.
+ */
+int arch_mutex_check_unlock(pthread_mutex_t *m, arch_mutex **pv)
+{
+    *pv = arch_mutex_of(m);
+#ifndef LIBPTHREAD_INLINE_MUTEX
+    if (*pv == NULL)
+        return EINVAL;
+#endif
+
+    if (arch_mutex_is_owned(*pv) && (*pv)->owner != (long) GetCurrentThreadId())
+        return EPERM;
+
+    return 0;
+}
+
+/**
+ * Move condition waiters to the mutex without waking them (wait morphing).
+ * @param pv The internal mutex object the waiters are waiting with.
+ * @param head The first waiter, already marked ARCH_COND_MORPHED.
+ * @param tail The last waiter, whose next link is NULL.
+ * @param n The number of waiters.
+ * @remark The waiters become sleepers of the mutex and each unlock wakes
+ *         one of them, instead of all of them racing for the mutex at once.
+ *         If the mutex is free nobody would unlock it, so we wake one now.
+ */
+void arch_mutex_requeue(arch_mutex *pv, arch_cond_waiter *head, arch_cond_waiter *tail, long n)
+{
+    long v;
+    arch_cond_waiter *node, *next;
+
+    if (pv->shared_serial != 0) {
+        /* Only the semaphore wakes sleepers of a shared mutex. */
+        for (node = head; node != NULL; node = next) {
+            next = node->next;
+            atomic_set(& node->state, ARCH_COND_SIGNALED);
+            arch_wake_by_address(& node->state, 1);
+        }
+        return;
     }
 
-    return EINVAL;
+    /* Link before counting, so an unlock that sees the count finds the node. */
+    pthread_spin_lock(& pv->morph_lock);
+    if (pv->morph_tail != NULL) pv->morph_tail->next = head;
+    else pv->morph_head = head;
+    pv->morph_tail = tail;
+    pv->morph += n * ARCH_MUTEX_MORPH_NODE;
+    v = atomic_fetch_and_add(& pv->lock_status, n * ARCH_MUTEX_WAITER) + n * ARCH_MUTEX_WAITER;
+    pthread_spin_unlock(& pv->morph_lock);
+
+    if ((v & ARCH_MUTEX_LOCKED) == 0)
+        arch_mutex_wake(pv, v);
+}
+
+/**
+ * Reacquire the mutex on the way out of pthread_cond_wait().
+ * @param m The pointer of the mutex object.
+ * @param counted Nonzero if the caller was woken from the mutex's queue by
+ *        arch_mutex_wake_one(), and so is still counted as its sleeper.
+ * @return Always return 0.
+ */
+int arch_mutex_relock(pthread_mutex_t *m, int counted)
+{
+    long sleeps = 0;
+    arch_mutex *pv = arch_mutex_of(m);
+    unsigned __int64 start = arch_mutex_stat_clock();
+
+    if (!counted)
+        return pthread_mutex_lock(m);
+
+    (void) arch_mutex_lock_wait(pv, NULL, &sleeps, ARCH_MUTEX_WOKEN);
+    arch_mutex_stat_acquired(m, pv, start, sleeps);
+
+    if (arch_mutex_is_owned(pv))
+        pv->owner = (long) GetCurrentThreadId();
+
+    return 0;
 }
 
 /**
@@ -416,11 +1225,120 @@ int pthread_mutex_unlock(pthread_mutex_t *m)
  */
 int pthread_mutex_destroy(pthread_mutex_t *m)
 {
+#ifndef LIBPTHREAD_INLINE_MUTEX
     arch_mutex *pv = (arch_mutex *) *m;
     if (pv != NULL) {
-        if (pv->sync != NULL) CloseHandle(pv->sync);
-        free(pv);
+#ifdef LIBPTHREAD_LOCKSTAT
+        arch_mutex_stat_detach(pv);
+#endif
+        arch_slab_free(pv, sizeof(arch_mutex));
     }
+#else
+    if (arch_mutex_of(m)->shared_serial != 0)
+        arch_mutex_shared_close(arch_mutex_of(m));
+#ifdef LIBPTHREAD_LOCKSTAT
+    arch_mutex_stat_detach(arch_mutex_of(m));
+#endif
+#endif
 
     return 0;
 }
+
+/**
+ * Set the name reported for a mutex by pthread_lockstat_snapshot_np().
+ * @param m The pointer of the mutex object.
+ * @param name The name, truncated to PTHREAD_LOCKSTAT_NAME_MAX - 1 bytes.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (EINVAL, ENOMEM, or ENOTSUP if the library was built without
+ *         LIBPTHREAD_LOCKSTAT or the mutex is process-shared).
+ */
+int pthread_mutex_setname_np(pthread_mutex_t *m, const char *name)
+{
+#ifdef LIBPTHREAD_LOCKSTAT
+    arch_mutex_stat *st;
+
+    if (name == NULL)
+        return EINVAL;
+
+#ifndef LIBPTHREAD_INLINE_MUTEX
+    if (*m == NULL) {
+        int rc = arch_mutex_init(m, NULL, 1);
+        if (rc != 0) return rc;
+    }
+#endif
+
+    if (arch_mutex_of(m)->shared_serial != 0)
+        return ENOTSUP;
+
+    if ((st = arch_mutex_stat_of(m, arch_mutex_of(m))) == NULL)
+        return ENOMEM;
+
+    pthread_spin_lock(& libpthread_lockstat_lock);
+    strncpy(st->name, name, sizeof(st->name) - 1);
+    st->name[sizeof(st->name) - 1] = '\0';
+    pthread_spin_unlock(& libpthread_lockstat_lock);
+
+    return 0;
+#else
+    return ENOTSUP;
+#endif
+}
+
+/**
+ * Copy the contention statistics of all live mutexes.
+ * @param buf The array to receive the statistics.
+ * @param count The number of elements of buf.
+ * @param total Receives the number of live mutexes, which may exceed count.
+ *        May be NULL.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (EINVAL, or ENOTSUP if the library was built without
+ *         LIBPTHREAD_LOCKSTAT).
+ * @remark A mutex appears once it was first locked or named. Counters are
+ *         read without stopping their owners, so each record is only
+ *         approximately consistent. Times are in time stamp counter cycles.
+ */
+int pthread_lockstat_snapshot_np(pthread_lockstat_np_t *buf, int count, int *total)
+{
+#ifdef LIBPTHREAD_LOCKSTAT
+    int n = 0;
+    arch_mutex_stat *st;
+    pthread_lockstat_np_t *ps;
+
+    if (count < 0 || (count > 0 && buf == NULL))
+        return EINVAL;
+
+    pthread_spin_lock(& libpthread_lockstat_lock);
+    for (st = libpthread_lockstat_list; st != NULL; st = st->next, n++) {
+        if (n >= count)
+            continue;
+
+        ps = buf + n;
+        ps->mutex = st->mutex;
+        memcpy(ps->name, st->name, sizeof(ps->name));
+        ps->type = st->pv->type;
+        ps->spin_count = st->pv->spin_count;
+        ps->acquisitions = st->acquisitions;
+        ps->trylock_failures = (unsigned long) st->trylock_failures;
+        ps->timeouts = (unsigned long) st->timeouts;
+        ps->spin_acquisitions = st->spin_acquisitions;
+        ps->kernel_waits = st->kernel_waits;
+        ps->polled_waits = (unsigned long) st->polled_waits;
+        ps->wait_cycles = st->wait_cycles;
+        ps->max_wait_cycles = st->max_wait_cycles;
+        ps->hold_cycles = st->hold_cycles;
+    }
+    pthread_spin_unlock(& libpthread_lockstat_lock);
+
+    if (total != NULL)
+        *total = n;
+
+    return 0;
+#else
+    if (total != NULL)
+        *total = 0;
+
+    return ENOTSUP;
+#endif
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file phaser.c
+ * @brief Implementation Code of Phaser Routines
+ *
+ * A phaser is a reusable barrier whose parties may register and deregister
+ * while it is in use, as java.util.concurrent.Phaser. The phase, the
+ * registered parties and the parties yet to arrive share one 64-bit word,
+ * so every change is a single CAS and no change stops the others. Waiters
+ * spin, then sleep, on the phase half of the word.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+/* The phase half of the state word, which waiters sleep on. */
+#define arch_phaser_phase_word(pv)  ((volatile long *) & (pv)->word.half[ARCH_PHASER_PHASE_HALF])
+
+static __inline long arch_phaser_phase(unsigned __int64 state)
+{
+    return (long) (state >> 32);
+}
+
+/*
+ * Arrive in the current phase, also deregistering when deregister is 1.
+ * The last arrival advances the phase and resets the count of parties yet
+ * to arrive, in the same CAS. We are counted in waiting from before the
+ * CAS until after the wakeup, since the advance may let a thread destroy
+ * the phaser.
+ */
+static int arch_phaser_arrive(arch_phaser *pv, long deregister, long *phase)
+{
+    unsigned __int64 s, n;
+    long unarrived, parties;
+
+    atomic_fetch_and_add(& pv->waiting, 1);
+
+    do {
+        s = (unsigned __int64) atomic_read64(& pv->word.state);
+        unarrived = (long) (s & ARCH_PHASER_UNARRIVED);
+        parties = (long) (s / ARCH_PHASER_PARTY & ARCH_PHASER_UNARRIVED) - deregister;
+
+        /* more arrivals than parties */
+        if (unarrived == 0) {
+            atomic_fetch_and_add(& pv->waiting, -1);
+            return EINVAL;
+        }
+
+        if (unarrived == 1)
+            n = (s & ~(ARCH_PHASER_PHASE - 1)) + ARCH_PHASER_PHASE + parties * ARCH_PHASER_PARTY + parties;
+        else
+            n = s - 1 - deregister * ARCH_PHASER_PARTY;
+    } while (atomic_cmpxchg64(& pv->word.state, (__int64) n, (__int64) s) != (__int64) s);
+
+    if (phase != NULL)
+        *phase = arch_phaser_phase(s);
+
+    if (unarrived == 1 && atomic_xchg(& pv->sleepers, 0))
+        arch_wake_by_address(arch_phaser_phase_word(pv), ARCH_WAKE_ALL);
+
+    atomic_fetch_and_add(& pv->waiting, -1);
+
+    return unarrived == 1 ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+/* Wait until the phaser has left phase. */
+static void arch_phaser_wait_for(arch_phaser *pv, long phase)
+{
+    unsigned __int64 deadline;
+    volatile long *word = arch_phaser_phase_word(pv);
+
+    if (pv->spin > 0) {
+        deadline = arch_cycles() + pv->spin;
+        while (atomic_read_acquire(word) == phase) {
+            if (arch_cycles() >= deadline)
+                break;
+            cpu_relax();
+        }
+    }
+
+    if (atomic_read_acquire(word) == phase) {
+        atomic_xchg(& pv->sleepers, 1);
+        while (atomic_read(word) == phase)
+            arch_wait_on_address(word, phase, INFINITE);
+    }
+}
+
+/**
+ * Create a phaser object.
+ * @param phaser The pointer of the phaser object.
+ * @param attr The pointer of the barrier attribute object, only its wait
+ *        policy is used, or NULL.
+ * @param parties The number of parties registered from the start, which
+ *        may be 0.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, an error number returned to indicate the error
+ *         (EINVAL or ENOMEM).
+ */
+int pthread_phaser_init(pthread_phaser_t *phaser, const pthread_barrierattr_t *attr, unsigned int parties)
+{
+    arch_phaser *pv;
+    int policy = PTHREAD_WAIT_POLICY_DEFAULT_NP;
+
+    if (parties > ARCH_PHASER_MAX_PARTIES)
+        return EINVAL;
+
+    if (attr != NULL && *attr != NULL)
+        policy = ((arch_barrier_attr *) *attr)->wait_policy;
+
+    if ((pv = arch_slab_alloc(sizeof(arch_phaser))) == NULL)
+        return ENOMEM;
+
+    pv->word.state = parties * ARCH_PHASER_PARTY + parties;
+    pv->spin = arch_wait_spin_cycles(policy);
+    *phaser = pv;
+
+    return 0;
+}
+
+/**
+ * Register parties with a phaser.
+ * @param phaser The pointer of the phaser object.
+ * @param parties The number of parties to add.
+ * @param phase The pointer to receive the phase the new parties arrive in
+ *        first, or NULL.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, an error number returned to indicate the error
+ *         (EINVAL, or EAGAIN if there would be more than 65535 parties).
+ * @remark The new parties are yet to arrive in the current phase, so it
+ *         does not advance without them.
+ */
+int pthread_phaser_register(pthread_phaser_t *phaser, unsigned int parties, long *phase)
+{
+    unsigned __int64 s;
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL || parties > ARCH_PHASER_MAX_PARTIES)
+        return EINVAL;
+
+    do {
+        s = (unsigned __int64) atomic_read64(& pv->word.state);
+        if ((s / ARCH_PHASER_PARTY & ARCH_PHASER_UNARRIVED) + parties > ARCH_PHASER_MAX_PARTIES)
+            return EAGAIN;
+    } while (atomic_cmpxchg64(& pv->word.state, (__int64) (s + parties * (ARCH_PHASER_PARTY + 1)), (__int64) s) != (__int64) s);
+
+    if (phase != NULL)
+        *phase = arch_phaser_phase(s);
+
+    return 0;
+}
+
+/**
+ * Deregister a party from a phaser.
+ * @param phaser The pointer of the phaser object.
+ * @param phase The phase the calling party last arrived in.
+ * @return If the function succeeds, the return value is 0, or
+ *         PTHREAD_BARRIER_SERIAL_THREAD if it advanced the phase.
+ *         Otherwise, an error number returned to indicate the error (EINVAL).
+ * @remark If the phaser is still in phase, the party is only removed from
+ *         the phases to come. If it has advanced, the party is also due in
+ *         the current phase, and leaves as pthread_phaser_arrive_and_deregister().
+ *         A party yet to arrive in the current phase, such as one just
+ *         registered, must leave with pthread_phaser_arrive_and_deregister(),
+ *         since the phase from pthread_phaser_register() would be taken as
+ *         an arrival and the phase would never advance.
+ */
+int pthread_phaser_deregister(pthread_phaser_t *phaser, long phase)
+{
+    unsigned __int64 s;
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    while (1) {
+        s = (unsigned __int64) atomic_read64(& pv->word.state);
+        if (arch_phaser_phase(s) != phase)
+            return arch_phaser_arrive(pv, 1, NULL);
+
+        /* We have arrived, so there is a party left besides the unarrived. */
+        if ((s / ARCH_PHASER_PARTY & ARCH_PHASER_UNARRIVED) <= (s & ARCH_PHASER_UNARRIVED))
+            return EINVAL;
+
+        if (atomic_cmpxchg64(& pv->word.state, (__int64) (s - ARCH_PHASER_PARTY), (__int64) s) == (__int64) s)
+            return 0;
+    }
+}
+
+/**
+ * Arrive at a phaser without waiting for the other parties.
+ * @param phaser The pointer of the phaser object.
+ * @param phase The pointer to receive the phase arrived in, for
+ *        pthread_phaser_await(), or NULL.
+ * @return If the function succeeds, the return value is 0, or
+ *         PTHREAD_BARRIER_SERIAL_THREAD for the arrival that advanced the phase.
+ *         Otherwise, an error number returned to indicate the error
+ *         (EINVAL, also if every registered party has already arrived).
+ */
+int pthread_phaser_arrive(pthread_phaser_t *phaser, long *phase)
+{
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    return arch_phaser_arrive(pv, 0, phase);
+}
+
+/**
+ * Arrive at a phaser and deregister, without waiting.
+ * @param phaser The pointer of the phaser object.
+ * @param phase The pointer to receive the phase arrived in, or NULL.
+ * @return As pthread_phaser_arrive().
+ * @remark When the last party leaves, the phase advances and the phaser
+ *         waits for new parties to register.
+ */
+int pthread_phaser_arrive_and_deregister(pthread_phaser_t *phaser, long *phase)
+{
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    return arch_phaser_arrive(pv, 1, phase);
+}
+
+/**
+ * Arrive at a phaser and wait for the other parties.
+ * @param phaser The pointer of the phaser object.
+ * @param phase The pointer to receive the phase arrived in, or NULL.
+ * @return As pthread_phaser_arrive().
+ */
+int pthread_phaser_arrive_and_wait(pthread_phaser_t *phaser, long *phase)
+{
+    int rc;
+    long arrived;
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    /* Counted until we stop waiting, not only while arriving. */
+    atomic_fetch_and_add(& pv->waiting, 1);
+
+    rc = arch_phaser_arrive(pv, 0, & arrived);
+    if (rc == 0)
+        arch_phaser_wait_for(pv, arrived);
+
+    atomic_fetch_and_add(& pv->waiting, -1);
+
+    if (phase != NULL && rc != EINVAL)
+        *phase = arrived;
+
+    return rc;
+}
+
+/**
+ * Wait for a phaser to leave a phase.
+ * @param phaser The pointer of the phaser object.
+ * @param phase The phase from pthread_phaser_arrive() or
+ *        pthread_phaser_register().
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ * @remark Returns at once if the phaser is already past phase.
+ */
+int pthread_phaser_await(pthread_phaser_t *phaser, long phase)
+{
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    atomic_fetch_and_add(& pv->waiting, 1);
+    arch_phaser_wait_for(pv, phase);
+    atomic_fetch_and_add(& pv->waiting, -1);
+
+    return 0;
+}
+
+/**
+ * Destroy a phaser object.
+ * @param phaser The pointer of the phaser object.
+ * @return Always return 0.
+ * @remark No thread may arrive or wait at the phaser any more, but threads
+ *         just released may still be leaving, which is waited for.
+ */
+int pthread_phaser_destroy(pthread_phaser_t *phaser)
+{
+    arch_phaser *pv = (arch_phaser *) *phaser;
+
+    if (pv != NULL) {
+        while (atomic_read(& pv->waiting) > 0)
+            cpu_relax();
+        arch_slab_free(pv, sizeof(arch_phaser));
+        *phaser = NULL;
+    }
+
+    return 0;
+}
@@ -76,7 +76,7 @@ int pthread_setconcurrency(int new_level)
  */
 int pthread_attr_init(pthread_attr_t *attr)
 {
-    arch_thread_attr *pv = calloc(1, sizeof(arch_thread_attr));
+    arch_thread_attr *pv = arch_slab_alloc(sizeof(arch_thread_attr));
     if (pv == NULL)
         return lc_set_errno(ENOMEM);
 
@@ -316,7 +316,7 @@ int pthread_attr_setstacksize(pthread_attr_t *attr, size_t size)
 int pthread_attr_destroy(pthread_attr_t *attr)
 {
     if (attr != NULL) {
-        free(*attr);
+        arch_slab_free(*attr, sizeof(arch_thread_attr));
         *attr = NULL;
     }
 
@@ -412,7 +412,11 @@ void pthread_cleanup_push(void (*cleanup_routine)(void *), void *arg)
     arch_thread_info *pv = TlsGetValue(libpthread_tls_index);
 
     if (pv != NULL) {
-        arch_thread_cleanup_list *node = calloc(1, sizeof(arch_thread_cleanup_list));
+        arch_thread_cleanup_list *node = arch_slab_alloc(sizeof(arch_thread_cleanup_list));
+
+        /* Out of memory, there is no way to report it. */
+        if (node == NULL)
+            return;
 
         node->arg = arg;
         node->cleaner = cleanup_routine;
@@ -457,7 +461,7 @@ void pthread_cleanup_pop(int execute)
         }
 
         prev = node->prev;
-        free(node);
+        arch_slab_free(node, sizeof(arch_thread_cleanup_list));
         if(prev == NULL)
             pv->cleanup_list = NULL;
         else
@@ -483,7 +487,7 @@ static unsigned int __stdcall worker_proxy (void *arg)
              *
              * node->cleaner(node->arg);
              */
-            free(node);
+            arch_slab_free(node, sizeof(arch_thread_cleanup_list));
             node = next;
         } while(node != NULL);
         pv->cleanup_list = NULL;
@@ -492,7 +496,7 @@ static unsigned int __stdcall worker_proxy (void *arg)
     /* Make sure we free ourselves if we are detached */
     if ((pv->state & PTHREAD_CREATE_DETACHED) == PTHREAD_CREATE_DETACHED) {
         CloseHandle (pv->handle);
-        free(pv);
+        arch_slab_free(pv, sizeof(arch_thread_info));
         TlsSetValue(libpthread_tls_index, NULL);
     }
 
@@ -512,7 +516,7 @@ static unsigned int __stdcall worker_proxy (void *arg)
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg)
 {
     unsigned stack_size = 0;
-    arch_thread_info *pv = calloc(1, sizeof(arch_thread_info));
+    arch_thread_info *pv = arch_slab_alloc(sizeof(arch_thread_info));
     if (pv == NULL)
         return lc_set_errno(ENOMEM);
 
@@ -524,7 +528,7 @@ int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_
     pv->handle = (HANDLE) _beginthreadex(NULL, stack_size, worker_proxy, pv, CREATE_SUSPENDED, NULL);
 
     if (pv->handle == INVALID_HANDLE_VALUE) {
-        free(pv);
+        arch_slab_free(pv, sizeof(arch_thread_info));
         return errno;
     }
 
@@ -561,7 +565,7 @@ void pthread_exit(void *value_ptr)
             do {
                 arch_thread_cleanup_list *prev = node->prev;
                 node->cleaner(node->arg);
-                free(node);
+                arch_slab_free(node, sizeof(arch_thread_cleanup_list));
                 node = prev;
             } while(node != NULL);
             pv->cleanup_list = NULL;
@@ -570,7 +574,7 @@ void pthread_exit(void *value_ptr)
         /* Make sure we free ourselves if we are detached */
         if ((pv->state & PTHREAD_CREATE_DETACHED) == PTHREAD_CREATE_DETACHED) {
             CloseHandle (pv->handle);
-            free(pv);
+            arch_slab_free(pv, sizeof(arch_thread_info));
             TlsSetValue(libpthread_tls_index, NULL);
         }
 
@@ -703,11 +707,14 @@ int pthread_equal(pthread_t t1, pthread_t t2)
  * @param value_ptr The pointer of the target thread return value.
  * @return If the function succeeds, the return value is 0.
  *         Otherwise an error number will be returned to indicate the error.
+ * @remark The thread object is released by a successful join, so joining
+ *         or detaching the same thread again is undefined, as in POSIX.
  * @bug The main thread do not support join.
  */
 int pthread_join(pthread_t thread, void **value_ptr)
 {
     DWORD dwFlags;
+    HANDLE handle;
     arch_thread_info *pv = (arch_thread_info *) thread;
 
     if (pv == NULL || pv->handle == NULL || !GetHandleInformation(pv->handle, &dwFlags))
@@ -720,11 +727,15 @@ int pthread_join(pthread_t thread, void **value_ptr)
         return EDEADLK;
 
     WaitForSingleObject(pv->handle, INFINITE);
-    CloseHandle(pv->handle);
+    handle = pv->handle;
+    pv->handle = NULL;
+    CloseHandle(handle);
 
     if (value_ptr)
         *value_ptr = pv->return_value;
 
+    arch_slab_free(pv, sizeof(arch_thread_info));
+
     return 0;
 }
 
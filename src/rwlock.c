@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file rwlock.c
+ * @brief Implementation Code of Read-Write Lock Routines
+ *
+ * The lock is biased towards readers, after BRAVO (Biased Locking for
+ * Reader-Writer Locks, Dice and Kogan, 2019). While the bias is on, a reader
+ * does not touch the lock at all: it publishes the lock in a slot of its
+ * own, on a cache line no other thread writes, and checks the bias again.
+ * A writer first takes the underlying lock word, which keeps new readers
+ * out, then turns the bias off and waits until no slot holds the lock.
+ *
+ * Revocation costs a scan of all threads, so the bias stays off for a
+ * multiple of the time the last revocation took, and readers turn it on
+ * again from the slow path afterwards. Locks written often thus behave
+ * like plain read-write locks.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+#define ARCH_RWLOCK_SLOTS   8 /* per thread, must be power of 2 */
+#define ARCH_RWLOCK_INHIBIT 9 /* bias off for this many times the revocation */
+
+typedef struct arch_rwlock_readers {
+    struct arch_rwlock_readers *next, *prev;
+    arch_rwlock * volatile slots[ARCH_RWLOCK_SLOTS];
+} arch_rwlock_readers;
+
+static DWORD libpthread_rwlock_tls_index = TLS_OUT_OF_INDEXES;
+
+/* Slots of all threads, guarded by libpthread_rwlock_lock. */
+static pthread_spinlock_t libpthread_rwlock_lock = PTHREAD_SPINLOCK_INITIALIZER;
+static arch_rwlock_readers *libpthread_rwlock_readers;
+
+/**
+ * Create a read-write lock attribute object.
+ * @param attr The pointer of the read-write lock attribute object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, ENOMEM returned to indicate the error.
+ */
+int pthread_rwlockattr_init(pthread_rwlockattr_t *attr)
+{
+    arch_rwlock_attr *pv = arch_slab_alloc(sizeof(arch_rwlock_attr));
+    if (pv == NULL)
+        return ENOMEM;
+
+    pv->pshared = PTHREAD_PROCESS_PRIVATE;
+
+    *attr = pv;
+
+    return 0;
+}
+
+/**
+ * Get the read-write lock process-shared attribute.
+ * @param attr The pointer of the read-write lock attribute object.
+ * @param pshared The process-shared attribute.
+ * @return Always return 0.
+ */
+int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *attr, int *pshared)
+{
+    arch_rwlock_attr *pv = (arch_rwlock_attr *) *attr;
+    *pshared = pv->pshared;
+    return 0;
+}
+
+/**
+ * Set the read-write lock process-shared attribute.
+ * @param attr The pointer of the read-write lock attribute object.
+ * @param pshared The process-shared attribute.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL or ENOTSUP returned to indicate the error.
+ * @remark The only type we support is PTHREAD_PROCESS_PRIVATE.
+ */
+int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *attr, int pshared)
+{
+    arch_rwlock_attr *pv = (arch_rwlock_attr *) *attr;
+
+    if (pshared == PTHREAD_PROCESS_SHARED)
+        return ENOTSUP;
+    if (pshared != PTHREAD_PROCESS_PRIVATE)
+        return EINVAL;
+
+    pv->pshared = pshared;
+    return 0;
+}
+
+/**
+ * Destroy a read-write lock attribute object.
+ * @param attr The pointer of the read-write lock attribute object.
+ * @return Always return 0.
+ */
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *attr)
+{
+    if (attr != NULL) {
+        arch_slab_free(*attr, sizeof(arch_rwlock_attr));
+        *attr = NULL;
+    }
+
+    return 0;
+}
+
+/* Objects come from the slab, so the low 6 bits carry nothing. */
+static __inline int arch_rwlock_slot_of(arch_rwlock *pv)
+{
+    uintptr_t key = (uintptr_t) pv >> 6;
+
+    return (int) ((key ^ (key >> 7)) & (ARCH_RWLOCK_SLOTS - 1));
+}
+
+static arch_rwlock_readers *arch_rwlock_readers_self(void)
+{
+    arch_rwlock_readers *r = TlsGetValue(libpthread_rwlock_tls_index);
+
+    if (r != NULL)
+        return r;
+
+    if ((r = arch_slab_alloc(sizeof(arch_rwlock_readers))) == NULL)
+        return NULL;
+
+    pthread_spin_lock(& libpthread_rwlock_lock);
+    r->next = libpthread_rwlock_readers;
+    if (r->next != NULL)
+        r->next->prev = r;
+    libpthread_rwlock_readers = r;
+    pthread_spin_unlock(& libpthread_rwlock_lock);
+
+    TlsSetValue(libpthread_rwlock_tls_index, r);
+    return r;
+}
+
+/*
+ * Publish the lock in our slot, then check the bias again: a writer that
+ * turned it off in between either sees the slot or we see the bias off.
+ */
+static __inline int arch_rwlock_fast_read(arch_rwlock *pv)
+{
+    arch_rwlock * volatile *slot;
+    arch_rwlock_readers *r;
+
+    if (!pv->rbias || (r = arch_rwlock_readers_self()) == NULL)
+        return 0;
+
+    slot = r->slots + arch_rwlock_slot_of(pv);
+    if (*slot != NULL) /* taken by another lock, or by this one recursively */
+        return 0;
+
+    (void) atomic_cmpxchg_ptr((void * volatile *) slot, pv, NULL);
+    if (atomic_read(& pv->rbias))
+        return 1;
+
+    *slot = NULL;
+    return 0;
+}
+
+static int arch_rwlock_visible_readers(arch_rwlock *pv)
+{
+    int i = arch_rwlock_slot_of(pv), found = 0;
+    arch_rwlock_readers *r;
+
+    pthread_spin_lock(& libpthread_rwlock_lock);
+    for (r = libpthread_rwlock_readers; r != NULL && !found; r = r->next)
+        found = r->slots[i] == pv;
+    pthread_spin_unlock(& libpthread_rwlock_lock);
+
+    return found;
+}
+
+static __inline void arch_rwlock_wake(arch_rwlock *pv)
+{
+    if (atomic_read(& pv->sleepers) > 0)
+        arch_wake_by_address(& pv->state, ARCH_WAKE_ALL);
+}
+
+/* Sleep while the lock word is v, returns ETIMEDOUT once the deadline passed. */
+static int arch_rwlock_sleep(arch_rwlock *pv, long v, const struct timespec *abs_timeout)
+{
+    __int64 rel;
+    DWORD ms = INFINITE;
+
+    if (abs_timeout != NULL) {
+        if ((rel = arch_rel_time_in_100ns(abs_timeout)) <= 0)
+            return ETIMEDOUT;
+
+        rel /= POW10_4;
+        if (rel == 0) {
+            /* Less than a millisecond left, don't let the kernel round it. */
+            SwitchToThread();
+            return 0;
+        }
+        ms = rel >= MAX_SLEEP_IN_MS ? MAX_SLEEP_IN_MS : (DWORD) rel;
+    }
+
+    (void) atomic_fetch_and_add(& pv->sleepers, 1);
+    (void) arch_wait_on_address(& pv->state, v, ms);
+    (void) atomic_fetch_and_add(& pv->sleepers, -1);
+
+    return 0;
+}
+
+static int arch_rwlock_read_slow(arch_rwlock *pv, const struct timespec *abs_timeout, int try)
+{
+    int rc;
+    long v;
+
+    while (1) {
+        v = atomic_read(& pv->state);
+        if ((v & (ARCH_RWLOCK_WRITER | ARCH_RWLOCK_WRITER_WAITERS)) == 0) {
+            if (v >= LONG_MAX - ARCH_RWLOCK_READER)
+                return EAGAIN;
+            if (atomic_cmpxchg(& pv->state, v + ARCH_RWLOCK_READER, v) == v)
+                break;
+            continue;
+        }
+
+        if (try)
+            return EBUSY;
+
+        if ((rc = arch_rwlock_sleep(pv, v, abs_timeout)) != 0)
+            return rc;
+    }
+
+    /* No writer can hold the lock now, so the bias may come back. */
+    if (!pv->rbias && arch_cycles() >= (unsigned __int64) atomic_read64(& pv->inhibit_until))
+        pv->rbias = 1;
+
+    return 0;
+}
+
+static __inline void arch_rwlock_write_release(arch_rwlock *pv)
+{
+    (void) atomic_fetch_and_add(& pv->state, -ARCH_RWLOCK_WRITER);
+    arch_rwlock_wake(pv);
+}
+
+/*
+ * Called with the lock word held for writing: turn the bias off and wait
+ * for the readers that are still visible in their slots.
+ */
+static int arch_rwlock_revoke(arch_rwlock *pv, const struct timespec *abs_timeout, int try)
+{
+    unsigned __int64 start;
+
+    if (!pv->rbias)
+        return 0;
+
+    start = arch_cycles();
+    pv->rbias = 0;
+    memory_barrier();
+
+    while (arch_rwlock_visible_readers(pv)) {
+        if (try || (abs_timeout != NULL && arch_rel_time_in_100ns(abs_timeout) <= 0)) {
+            arch_rwlock_write_release(pv);
+            return try ? EBUSY : ETIMEDOUT;
+        }
+        SwitchToThread();
+    }
+
+    /* Read by readers without the lock, so never torn on 32-bit. */
+    atomic_set64(& pv->inhibit_until, (__int64) (arch_cycles() + (arch_cycles() - start) * ARCH_RWLOCK_INHIBIT));
+    return 0;
+}
+
+static int arch_rwlock_write(arch_rwlock *pv, const struct timespec *abs_timeout, int try)
+{
+    int rc;
+    long v, queued = 0;
+
+    while (1) {
+        v = atomic_read(& pv->state);
+        if ((v & ARCH_RWLOCK_WRITER) == 0 && v < ARCH_RWLOCK_READER) {
+            if (atomic_cmpxchg(& pv->state, (v | ARCH_RWLOCK_WRITER) - queued, v) == v)
+                break;
+            continue;
+        }
+
+        if (try)
+            return EBUSY;
+
+        /* Count ourselves as waiting, so new readers hold back. */
+        if (!queued) {
+            if (atomic_cmpxchg(& pv->state, v + ARCH_RWLOCK_WRITER_WAITER, v) != v)
+                continue;
+            queued = ARCH_RWLOCK_WRITER_WAITER;
+            v += ARCH_RWLOCK_WRITER_WAITER;
+        }
+
+        if ((rc = arch_rwlock_sleep(pv, v, abs_timeout)) != 0) {
+            (void) atomic_fetch_and_add(& pv->state, -queued);
+            arch_rwlock_wake(pv);
+            return rc;
+        }
+    }
+
+    return arch_rwlock_revoke(pv, abs_timeout, try);
+}
+
+static int arch_rwlock_init_lazy(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr, int lock)
+{
+    arch_rwlock *pv;
+
+    if (attr != NULL && *attr != NULL && ((arch_rwlock_attr *) *attr)->pshared == PTHREAD_PROCESS_SHARED)
+        return ENOTSUP;
+
+    if ((pv = arch_slab_alloc(sizeof(arch_rwlock))) == NULL)
+        return ENOMEM;
+
+    if (!lock) {
+        *rwlock = pv;
+        return 0;
+    }
+
+    if (atomic_cmpxchg_ptr(rwlock, pv, NULL) != NULL) {
+        arch_slab_free(pv, sizeof(arch_rwlock));
+    }
+
+    return 0;
+}
+
+/**
+ * Create a read-write lock.
+ * @param rwlock The pointer of the read-write lock object.
+ * @param attr The pointer of the read-write lock attribute object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM or ENOTSUP).
+ * @remark PTHREAD_RWLOCK_INITIALIZER is also supported, the object is then
+ *         created on first use.
+ */
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr)
+{
+    *rwlock = NULL;
+    return arch_rwlock_init_lazy(rwlock, attr, 0);
+}
+
+/**
+ * Destroy a read-write lock.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EBUSY returned if the lock is held or waited for.
+ */
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+    arch_rwlock *pv = (arch_rwlock *) *rwlock;
+
+    if (pv != NULL) {
+        if (pv->state != 0 || pv->sleepers != 0 || (pv->rbias && arch_rwlock_visible_readers(pv)))
+            return EBUSY;
+        arch_slab_free(pv, sizeof(arch_rwlock));
+        *rwlock = NULL;
+    }
+
+    return 0;
+}
+
+/**
+ * Acquire a read-write lock for reading.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM or EAGAIN).
+ * @remark Writers are preferred: a thread already holding the lock for
+ *         reading must not read-lock it again while a writer may wait.
+ */
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    arch_rwlock *pv;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    if (arch_rwlock_fast_read(pv))
+        return 0;
+
+    return arch_rwlock_read_slow(pv, NULL, 0);
+}
+
+/**
+ * Acquire a read-write lock for reading, or give up at an absolute deadline.
+ * @param rwlock The pointer of the read-write lock object.
+ * @param abs_timeout The absolute deadline, in CLOCK_REALTIME.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EINVAL, EAGAIN or ETIMEDOUT).
+ */
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abs_timeout)
+{
+    arch_rwlock *pv;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    if (arch_rwlock_fast_read(pv))
+        return 0;
+
+    if (abs_timeout == NULL || abs_timeout->tv_nsec < 0 || abs_timeout->tv_nsec >= POW10_9)
+        return EINVAL;
+
+    return arch_rwlock_read_slow(pv, abs_timeout, 0);
+}
+
+/**
+ * Try acquire a read-write lock for reading.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EAGAIN or EBUSY).
+ */
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+    arch_rwlock *pv;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    if (arch_rwlock_fast_read(pv))
+        return 0;
+
+    return arch_rwlock_read_slow(pv, NULL, 1);
+}
+
+/**
+ * Acquire a read-write lock for writing.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, ENOMEM returned to indicate the error.
+ */
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    arch_rwlock *pv;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    return arch_rwlock_write(pv, NULL, 0);
+}
+
+/**
+ * Acquire a read-write lock for writing, or give up at an absolute deadline.
+ * @param rwlock The pointer of the read-write lock object.
+ * @param abs_timeout The absolute deadline, in CLOCK_REALTIME.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM, EINVAL or ETIMEDOUT).
+ */
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abs_timeout)
+{
+    arch_rwlock *pv;
+
+    if (abs_timeout == NULL || abs_timeout->tv_nsec < 0 || abs_timeout->tv_nsec >= POW10_9)
+        return EINVAL;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    return arch_rwlock_write(pv, abs_timeout, 0);
+}
+
+/**
+ * Try acquire a read-write lock for writing.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (ENOMEM or EBUSY).
+ * @remark Fails with EBUSY, rather than wait, if readers are still visible
+ *         in their slots when the reader bias is revoked.
+ */
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+    arch_rwlock *pv;
+
+    if (*rwlock == NULL) {
+        int rc = arch_rwlock_init_lazy(rwlock, NULL, 1);
+        if (rc != 0) return rc;
+    }
+
+    pv = (arch_rwlock *) *rwlock;
+    return arch_rwlock_write(pv, NULL, 1);
+}
+
+/**
+ * Release a read-write lock.
+ * @param rwlock The pointer of the read-write lock object.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise an error number will be returned to indicate the error
+ *         (EINVAL, or EPERM if the lock is not held).
+ */
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    long v;
+    arch_rwlock *pv = (arch_rwlock *) *rwlock;
+    arch_rwlock_readers *r;
+
+    if (pv == NULL)
+        return EINVAL;
+
+    /* A fast reader only has to clear its own slot. */
+    r = TlsGetValue(libpthread_rwlock_tls_index);
+    if (r != NULL && r->slots[arch_rwlock_slot_of(pv)] == pv) {
+        r->slots[arch_rwlock_slot_of(pv)] = NULL;
+        return 0;
+    }
+
+    v = atomic_read(& pv->state);
+    if (v & ARCH_RWLOCK_WRITER) {
+        arch_rwlock_write_release(pv);
+        return 0;
+    }
+
+    if (v < ARCH_RWLOCK_READER)
+        return EPERM;
+
+    /* The last reader out lets the writers in. */
+    v = atomic_fetch_and_add(& pv->state, -ARCH_RWLOCK_READER) - ARCH_RWLOCK_READER;
+    if (v < ARCH_RWLOCK_READER)
+        arch_rwlock_wake(pv);
+
+    return 0;
+}
+
+/**
+ * Release the reader slots of the calling thread, called on thread detach.
+ */
+void arch_rwlock_thread_exit(void)
+{
+    arch_rwlock_readers *r;
+
+    if (libpthread_rwlock_tls_index == TLS_OUT_OF_INDEXES)
+        return;
+
+    if ((r = TlsGetValue(libpthread_rwlock_tls_index)) == NULL)
+        return;
+
+    pthread_spin_lock(& libpthread_rwlock_lock);
+    if (r->prev != NULL) r->prev->next = r->next;
+    else libpthread_rwlock_readers = r->next;
+    if (r->next != NULL) r->next->prev = r->prev;
+    pthread_spin_unlock(& libpthread_rwlock_lock);
+
+    TlsSetValue(libpthread_rwlock_tls_index, NULL);
+    arch_slab_free(r, sizeof(arch_rwlock_readers));
+}
+
+int arch_rwlock_init(void)
+{
+    if ((libpthread_rwlock_tls_index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+        return 0;
+
+    return 1;
+}
+
+void arch_rwlock_fini(void)
+{
+    arch_rwlock_thread_exit();
+    TlsFree(libpthread_rwlock_tls_index);
+    libpthread_rwlock_tls_index = TLS_OUT_OF_INDEXES;
+}
@@ -20,17 +20,271 @@
 /**
  * @file sem.c
  * @brief Implementation Code of Semaphore Routines
+ *
+ * Private and named semaphores count in userspace: a waiter takes a unit
+ * with a CAS, spins for a while when there is none, and only then sleeps,
+ * after announcing itself in waiters so that sem_post() knows a wakeup is
+ * needed.
+ *
+ * A named semaphore is a name section, holding arch_sem_name, and a count
+ * section per generation of the name, both backed by the paging file and
+ * mapped by every process that opens it. sem_unlink() moves the name to
+ * the next generation, so later opens no longer find the old count.
  */
 
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <winsock2.h>
 
 #include "arch.h"
 #include "misc.h"
 
+#define ARCH_SEM_NAME_MAX   512
+
+/*
+ * Kernel object namespaces a named semaphore may live in, the global one
+ * first, which needs SeCreateGlobalPrivilege to create a section in.
+ */
+static const char *libpthread_sem_namespaces[] = { "Global\\", "Local\\" };
+
+/*
+ * Names created by this process and not unlinked yet, which it keeps open
+ * so that they outlive sem_close(), guarded by libpthread_sem_lock.
+ */
+typedef struct arch_sem_link {
+    struct arch_sem_link *next;
+    HANDLE name;
+    HANDLE mapping;
+    char path[1];
+} arch_sem_link;
+
+static pthread_spinlock_t libpthread_sem_lock = PTHREAD_SPINLOCK_INITIALIZER;
+static arch_sem_link *libpthread_sem_links;
+
+/* Take up to max units, return how many were taken. */
+static __inline long arch_sem_trydown(arch_sem_t *pv, long max)
+{
+    long v, n;
+
+    while ((v = atomic_read(& pv->count->value)) > 0) {
+        n = v < max ? v : max;
+        if (atomic_cmpxchg(& pv->count->value, v - n, v) == v)
+            return n;
+    }
+
+    return 0;
+}
+
+/*
+ * Take at least one and up to max units of a counted semaphore, blocking
+ * until abs_timeout if given, and return how many were taken in got.
+ */
+static int arch_sem_down(arch_sem_t *pv, long max, const struct timespec *abs_timeout, long *got)
+{
+    DWORD ms;
+    unsigned __int64 deadline;
+
+    if ((*got = arch_sem_trydown(pv, max)) > 0)
+        return 0;
+
+    if (abs_timeout != NULL && arch_rel_time_in_ms(abs_timeout) == 0)
+        return ETIMEDOUT;
+
+    deadline = arch_cycles() + arch_wait_spin_cycles(PTHREAD_WAIT_POLICY_DEFAULT_NP);
+    while (arch_cycles() < deadline) {
+        cpu_relax();
+        if (atomic_read(& pv->count->value) > 0 && (*got = arch_sem_trydown(pv, max)) > 0)
+            return 0;
+    }
+
+    /* Retry the take only after each wait, so a timeout never takes two units. */
+    atomic_fetch_and_add(& pv->count->waiters, 1);
+    while ((*got = arch_sem_trydown(pv, max)) == 0) {
+        ms = abs_timeout == NULL ? INFINITE : arch_rel_time_in_ms(abs_timeout);
+        if (ms == 0)
+            break;
+        if (pv->mapping == NULL)
+            arch_wait_on_address(& pv->count->value, 0, ms);
+        else
+            WaitForSingleObject(pv->handle, ms);
+    }
+    atomic_fetch_and_add(& pv->count->waiters, -1);
+
+    return *got > 0 ? 0 : ETIMEDOUT;
+}
+
+/*
+ * Add n units to a counted semaphore, waking as many sleepers, but no more
+ * than are counted, all at once if that is all of them. A named one may
+ * be left with surplus wakeups, which its waiters absorb as spurious.
+ */
+static int arch_sem_up(arch_sem_t *pv, long n)
+{
+    long v, w;
+
+    do {
+        v = atomic_read(& pv->count->value);
+        if (v > SEM_VALUE_MAX - n)
+            return EOVERFLOW;
+    } while (atomic_cmpxchg(& pv->count->value, v + n, v) != v);
+
+    if ((w = atomic_read(& pv->count->waiters)) > 0) {
+        if (pv->mapping == NULL)
+            arch_wake_by_address(& pv->count->value, n < w ? n : ARCH_WAKE_ALL);
+        else
+            ReleaseSemaphore(pv->handle, n < w ? n : w, NULL);
+    }
+
+    return 0;
+}
+
+/* Map the last error of a named semaphore call to an errno value. */
+static int arch_sem_error(void)
+{
+    switch (GetLastError()) {
+    case ERROR_ACCESS_DENIED:
+        return EACCES;
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_INVALID_HANDLE:
+        return ENOENT;
+    case ERROR_NOT_ENOUGH_MEMORY:
+        return ENOMEM;
+    default:
+        return ENOSPC;
+    }
+}
+
+/*
+ * Open the name section of a named semaphore, creating it if asked, in
+ * the global namespace if it is there or may be created there, else in
+ * the session one, which is returned in ns.
+ */
+static HANDLE arch_sem_open_name(const char *name, int create, const char **ns)
+{
+    int i;
+    char path[ARCH_SEM_NAME_MAX];
+    HANDLE h;
+
+    for (i = 0; i < 2; i++) {
+        sprintf(path, "%slibpthread-sem-%s", libpthread_sem_namespaces[i], name);
+        if ((h = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, path)) != NULL) {
+            *ns = libpthread_sem_namespaces[i];
+            return h;
+        }
+    }
+
+    if (!create) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+        sprintf(path, "%slibpthread-sem-%s", libpthread_sem_namespaces[i], name);
+        h = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(arch_sem_name), path);
+        if (h != NULL) {
+            *ns = libpthread_sem_namespaces[i];
+            return h;
+        }
+        if (GetLastError() != ERROR_ACCESS_DENIED)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Release the count section of a named semaphore, and its sleep queue. */
+static void arch_sem_close_count(arch_sem_t *pv)
+{
+    if (pv->handle != NULL)
+        CloseHandle(pv->handle);
+    if (pv->count != NULL)
+        UnmapViewOfFile(pv->count);
+    if (pv->mapping != NULL)
+        CloseHandle(pv->mapping);
+
+    pv->handle = pv->mapping = NULL;
+    pv->count = NULL;
+}
+
+/*
+ * Create or open the count section of one generation of a named semaphore,
+ * with the kernel semaphore its waiters sleep on. Set created if the count
+ * section did not exist, so is still zero-filled.
+ */
+static int arch_sem_open_count(arch_sem_t *pv, const char *ns, const char *name, long generation, int *created)
+{
+    char path[ARCH_SEM_NAME_MAX];
+
+    sprintf(path, "%slibpthread-sem-%s-%lx", ns, name, generation);
+    pv->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(arch_sem_count), path);
+    if (pv->mapping == NULL)
+        return 0;
+    *created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+    pv->count = (arch_sem_count *) MapViewOfFile(pv->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(arch_sem_count));
+    sprintf(path, "%slibpthread-sem-%s-%lx-wait", ns, name, generation);
+    if (pv->count == NULL || (pv->handle = CreateSemaphore(NULL, 0, SEM_VALUE_MAX, path)) == NULL) {
+        arch_sem_close_count(pv);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Keep a semaphore this process has just created open until it is unlinked
+ * here, or the process exits, so that it survives sem_close().
+ */
+static void arch_sem_hold(arch_sem_t *pv, const char *ns, const char *name)
+{
+    HANDLE self = GetCurrentProcess();
+    arch_sem_link *link;
+
+    if ((link = (arch_sem_link *) malloc(sizeof(arch_sem_link) + strlen(ns) + strlen(name))) == NULL)
+        return;
+
+    sprintf(link->path, "%s%s", ns, name);
+    if (!DuplicateHandle(self, pv->name, self, & link->name, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        free(link);
+        return;
+    }
+    if (!DuplicateHandle(self, pv->mapping, self, & link->mapping, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        CloseHandle(link->name);
+        free(link);
+        return;
+    }
+
+    pthread_spin_lock(& libpthread_sem_lock);
+    link->next = libpthread_sem_links;
+    libpthread_sem_links = link;
+    pthread_spin_unlock(& libpthread_sem_lock);
+}
+
+/* Drop what arch_sem_hold() kept of a name, if anything. */
+static void arch_sem_release(const char *ns, const char *name)
+{
+    size_t len = strlen(ns);
+    arch_sem_link *link, **prev;
+
+    pthread_spin_lock(& libpthread_sem_lock);
+    for (prev = & libpthread_sem_links; (link = *prev) != NULL; prev = & link->next) {
+        if (strncmp(link->path, ns, len) == 0 && strcmp(link->path + len, name) == 0) {
+            *prev = link->next;
+            break;
+        }
+    }
+    pthread_spin_unlock(& libpthread_sem_lock);
+
+    if (link != NULL) {
+        CloseHandle(link->mapping);
+        CloseHandle(link->name);
+        free(link);
+    }
+}
+
 /**
  * Create an unnamed semaphore.
  * @param sem The pointer of the semaphore object.
@@ -51,15 +305,19 @@ int sem_init(sem_t *sem, int pshared, unsigned int value)
     if (sem == NULL || value > (unsigned int) SEM_VALUE_MAX)
         return lc_set_errno(EINVAL);
 
-    if (NULL == (pv = (arch_sem_t *)calloc(1, sizeof(arch_sem_t))))
+    if (NULL == (pv = (arch_sem_t *) arch_slab_alloc(sizeof(arch_sem_t))))
         return lc_set_errno(ENOMEM);
 
-    if (pshared != PTHREAD_PROCESS_PRIVATE) {
-        sprintf(buf, "Global\\%p", pv);
+    if (pshared == PTHREAD_PROCESS_PRIVATE) {
+        pv->count = & pv->local;
+        pv->local.value = value;
+        *sem = pv;
+        return 0;
     }
 
+    sprintf(buf, "Global\\%p", pv);
     if ((pv->handle = CreateSemaphore (NULL, value, SEM_VALUE_MAX, buf)) == NULL) {
-        free(pv);
+        arch_slab_free(pv, sizeof(arch_sem_t));
         return lc_set_errno(ENOSPC);
     }
 
@@ -76,11 +334,15 @@ int sem_init(sem_t *sem, int pshared, unsigned int value)
  */
 int sem_wait(sem_t *sem)
 {
+    long got;
     arch_sem_t *pv = (arch_sem_t *) sem;
 
     if (sem == NULL || pv == NULL)
         return lc_set_errno(EINVAL);
 
+    if (pv->count != NULL)
+        return arch_sem_down(pv, 1, NULL, & got);
+
     if (WaitForSingleObject(pv->handle, INFINITE) != WAIT_OBJECT_0)
         return lc_set_errno(EINVAL);
 
@@ -102,6 +364,9 @@ int sem_trywait(sem_t *sem)
     if (sem == NULL || pv == NULL)
         return lc_set_errno(EINVAL);
 
+    if (pv->count != NULL)
+        return arch_sem_trydown(pv, 1) ? 0 : lc_set_errno(EAGAIN);
+
     if ((rc = WaitForSingleObject(pv->handle, 0)) == WAIT_OBJECT_0)
         return 0;
 
@@ -123,12 +388,19 @@ int sem_trywait(sem_t *sem)
  */
 int sem_timedwait(sem_t *sem, const struct timespec *abs_timeout)
 {
+    long got;
     unsigned rc;
     arch_sem_t *pv = (arch_sem_t *) sem;
 
     if (sem == NULL || pv == NULL)
         return lc_set_errno(EINVAL);
 
+    if (pv->count != NULL) {
+        if (arch_sem_down(pv, 1, abs_timeout, & got) != 0)
+            return lc_set_errno(ETIMEDOUT);
+        return 0;
+    }
+
     if ((rc = WaitForSingleObject(pv->handle, arch_rel_time_in_ms(abs_timeout))) == WAIT_OBJECT_0)
         return 0;
 
@@ -152,6 +424,9 @@ int sem_post(sem_t *sem)
     if (sem == NULL || pv == NULL)
         return lc_set_errno(EINVAL);
 
+    if (pv->count != NULL)
+        return arch_sem_up(pv, 1) != 0 ? lc_set_errno(EOVERFLOW) : 0;
+
     if (ReleaseSemaphore(pv->handle, 1, NULL) == 0) {
         if (ERROR_TOO_MANY_POSTS == GetLastError())
             return lc_set_errno(EOVERFLOW);
@@ -161,6 +436,75 @@ int sem_post(sem_t *sem)
     return 0;
 }
 
+/**
+ * Release a semaphore several times at once.
+ * @param sem The pointer of the semaphore object.
+ * @param count The number of units to release, which wakes up to as
+ *        many waiters.
+ * @return If the function succeeds, the return value is 0.
+ *         If the function fails, the return value is -1,
+ *         with errno set to indicate the error.
+ * @remark Same as count calls of sem_post(), in a single operation.
+ */
+int sem_post_multiple_np(sem_t *sem, int count)
+{
+    arch_sem_t *pv = (arch_sem_t *) sem;
+
+    if (sem == NULL || pv == NULL || count < 0)
+        return lc_set_errno(EINVAL);
+
+    if (count == 0)
+        return 0;
+
+    if (pv->count != NULL)
+        return arch_sem_up(pv, count) != 0 ? lc_set_errno(EOVERFLOW) : 0;
+
+    if (ReleaseSemaphore(pv->handle, count, NULL) == 0) {
+        if (ERROR_TOO_MANY_POSTS == GetLastError())
+            return lc_set_errno(EOVERFLOW);
+        return lc_set_errno(EINVAL);
+    }
+
+    return 0;
+}
+
+/**
+ * Acquire a semaphore several times at once.
+ * @param sem The pointer of the semaphore object.
+ * @param max The most units to acquire.
+ * @param got The pointer to receive the number of units acquired, which
+ *        is at least 1 and at most max.
+ * @return If the function succeeds, the return value is 0.
+ *         If the function fails, the return value is -1,
+ *         with errno set to indicate the error.
+ * @remark Blocks until a unit is available, then takes as many of the
+ *         available units as allowed, without waiting for more.
+ */
+int sem_wait_multiple_np(sem_t *sem, int max, int *got)
+{
+    long n;
+    arch_sem_t *pv = (arch_sem_t *) sem;
+
+    if (sem == NULL || pv == NULL || got == NULL || max < 1)
+        return lc_set_errno(EINVAL);
+
+    if (pv->count != NULL) {
+        arch_sem_down(pv, max, NULL, & n);
+        *got = n;
+        return 0;
+    }
+
+    /* A kernel semaphore gives one unit per wait. */
+    if (WaitForSingleObject(pv->handle, INFINITE) != WAIT_OBJECT_0)
+        return lc_set_errno(EINVAL);
+
+    for (n = 1; n < max && WaitForSingleObject(pv->handle, 0) == WAIT_OBJECT_0; n++)
+        ;
+    *got = n;
+
+    return 0;
+}
+
 /**
  * Get the value of a semaphore.
  * @param sem The pointer of the semaphore object.
@@ -174,6 +518,14 @@ int sem_getvalue(sem_t *sem, int *value)
     long previous;
     arch_sem_t *pv = (arch_sem_t *) sem;
 
+    if (sem == NULL || pv == NULL || value == NULL)
+        return lc_set_errno(EINVAL);
+
+    if (pv->count != NULL) {
+        *value = atomic_read(& pv->count->value);
+        return 0;
+    }
+
     switch (WaitForSingleObject(pv->handle, 0)) {
     case WAIT_OBJECT_0:
         if (!ReleaseSemaphore(pv->handle, 1, &previous))
@@ -202,11 +554,14 @@ int sem_destroy(sem_t *sem)
     if (pv == NULL)
         return lc_set_errno(EINVAL);
 
-    if (CloseHandle (pv->handle) == 0)
+    if (pv->mapping != NULL) {
+        arch_sem_close_count(pv);
+        CloseHandle(pv->name);
+    } else if (pv->handle != NULL && CloseHandle (pv->handle) == 0) {
         return lc_set_errno(EINVAL);
+    }
 
-    free(pv);
-    *sem = NULL;
+    arch_slab_free(pv, sizeof(arch_sem_t));
 
     return 0;
 }
@@ -224,61 +579,84 @@ int sem_destroy(sem_t *sem)
  *        the semaphore.
  * @return On success, returns the address of the new semaphore; On error,
  *         returns SEM_FAILED (NULL), with errno set to indicate the error.
+ * @remark A semaphore lives until it is unlinked, or until the process
+ *         that created it has exited and every other one has closed it.
  */
 sem_t *sem_open(const char *name, int oflag, mode_t mode, unsigned int value)
 {
-    int len;
-    char buffer[512];
+    int rc, created;
+    long state;
+    const char *ns;
     arch_sem_t *pv;
+    arch_sem_name *link = NULL;
 
-    if (value > (unsigned int) SEM_VALUE_MAX || (len = strlen(name)) > (int) sizeof(buffer) - 8 || len < 1) {
+    if (name == NULL || value > (unsigned int) SEM_VALUE_MAX || name[0] == '\0'
+        || strlen(name) > ARCH_SEM_NAME_MAX - 64) {
         lc_set_errno(EINVAL);
         return NULL;
     }
 
-    if (NULL == (pv = (arch_sem_t *)calloc(1, sizeof(arch_sem_t)))) {
+    if (NULL == (pv = (arch_sem_t *) arch_slab_alloc(sizeof(arch_sem_t)))) {
         lc_set_errno(ENOMEM);
         return NULL;
     }
 
-    memcpy(buffer, "Global\\", 7);
-    memcpy(buffer + 7, name, len);
-    buffer[len + 7] = '\0';
+    if ((pv->name = arch_sem_open_name(name, oflag & O_CREAT, & ns)) == NULL
+        || (link = (arch_sem_name *) MapViewOfFile(pv->name, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(arch_sem_name))) == NULL) {
+        rc = arch_sem_error();
+        goto fail;
+    }
 
-    if ((pv->handle = CreateSemaphore (NULL, value, SEM_VALUE_MAX, buffer)) == NULL)
-    {
-        switch(GetLastError()) {
-            case ERROR_ACCESS_DENIED:
-                lc_set_errno(EACCES);
-                break;
-            case ERROR_INVALID_HANDLE:
-                lc_set_errno(ENOENT);
-                break;
-            default:
-                lc_set_errno(ENOSPC);
-                break;
+    while (1) {
+        state = atomic_read(& link->state);
+        if (!(state & ARCH_SEM_LINKED) && !(oflag & O_CREAT)) {
+            rc = ENOENT;
+            goto fail;
         }
-        free(pv);
-        return NULL;
-    } else {
-        if (GetLastError() == ERROR_ALREADY_EXISTS) {
-            if ((oflag & O_CREAT) && (oflag & O_EXCL)) {
-                CloseHandle(pv->handle);
-                free(pv);
-                lc_set_errno(EEXIST);
-                return NULL;
+        if ((state & ARCH_SEM_LINKED) && (oflag & O_CREAT) && (oflag & O_EXCL)) {
+            rc = EEXIST;
+            goto fail;
+        }
+
+        if (!arch_sem_open_count(pv, ns, name, state / ARCH_SEM_GENERATION, & created)) {
+            rc = arch_sem_error();
+            goto fail;
+        }
+
+        if (!(state & ARCH_SEM_LINKED)) {
+            /* The count exists before the name links it, so openers find it. */
+            if (atomic_cmpxchg(& link->state, state | ARCH_SEM_LINKED, state) == state) {
+                pv->count->value = value;
+                atomic_set_release(& pv->count->ready, 1);
+                arch_sem_hold(pv, ns, name);
+                break;
             }
-            return (sem_t *) pv;
+        } else if (!created) {
+            /* Wait for its creator to set the initial value. */
+            while (!atomic_read_acquire(& pv->count->ready) && atomic_read(& link->state) == state)
+                SwitchToThread();
+            if (atomic_read_acquire(& pv->count->ready))
+                break;
         } else {
-            if (!(oflag & O_CREAT)) {
-                free(pv);
-                lc_set_errno(ENOENT);
-                return NULL;
-            }
+            /* Linked, but every process that had it open is gone, and it with them. */
+            atomic_cmpxchg(& link->state, state - ARCH_SEM_LINKED + ARCH_SEM_GENERATION, state);
         }
+
+        arch_sem_close_count(pv);
     }
 
+    UnmapViewOfFile(link);
     return (sem_t *) pv;
+
+fail:
+    arch_sem_close_count(pv);
+    if (link != NULL)
+        UnmapViewOfFile(link);
+    if (pv->name != NULL)
+        CloseHandle(pv->name);
+    arch_slab_free(pv, sizeof(arch_sem_t));
+    lc_set_errno(rc);
+    return NULL;
 }
 
 /**
@@ -300,10 +678,39 @@ int sem_close(sem_t *sem)
  * @return If the function succeeds, the return value is 0.
  *         If the function fails, the return value is -1,
  *         with errno set to indicate the error.
- * @remark The semaphore object is destroyed when its last handle has been
- *         closed, so this function does nothing.
+ * @remark The name is removed at once, so later sem_open() calls create a
+ *         new semaphore, while processes that have it open keep using the
+ *         old one until they close it.
  */
 int sem_unlink(const char *name)
 {
+    long state;
+    const char *ns;
+    HANDLE h;
+    arch_sem_name *link;
+
+    if (name == NULL || name[0] == '\0' || strlen(name) > ARCH_SEM_NAME_MAX - 64)
+        return lc_set_errno(EINVAL);
+
+    if ((h = arch_sem_open_name(name, 0, & ns)) == NULL)
+        return lc_set_errno(arch_sem_error());
+
+    if ((link = (arch_sem_name *) MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(arch_sem_name))) == NULL) {
+        CloseHandle(h);
+        return lc_set_errno(ENOMEM);
+    }
+
+    do {
+        state = atomic_read(& link->state);
+    } while ((state & ARCH_SEM_LINKED)
+        && atomic_cmpxchg(& link->state, state - ARCH_SEM_LINKED + ARCH_SEM_GENERATION, state) != state);
+
+    UnmapViewOfFile(link);
+    CloseHandle(h);
+
+    if (!(state & ARCH_SEM_LINKED))
+        return lc_set_errno(ENOENT);
+
+    arch_sem_release(ns, name);
     return 0;
 }
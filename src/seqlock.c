@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file seqlock.c
+ * @brief Implementation Code of Sequence Lock Routines
+ *
+ * The sequence is odd while a writer is in. A reader takes the sequence as
+ * its stamp, reads the data without any store, and the read is valid only
+ * if the sequence still equals the stamp afterwards, as with the optimistic
+ * reads of Java's StampedLock. Writers serialize on a ticket spin lock.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+/**
+ * Initialize a sequence lock.
+ * @param  lock The sequence lock object.
+ * @param  pshared Must be PTHREAD_PROCESS_PRIVATE (0).
+ * @return If the pshared is PTHREAD_PROCESS_PRIVATE, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ */
+int pthread_seqlock_init(pthread_seqlock_t *lock, int pshared)
+{
+    if (PTHREAD_PROCESS_PRIVATE != pshared)
+        return EINVAL;
+
+    lock->sequence = 0;
+    return pthread_spin_init(& lock->lock, pshared);
+}
+
+/**
+ * Start an optimistic read.
+ * @param  lock The sequence lock object.
+ * @return The stamp to pass to pthread_seqlock_read_validate().
+ * @remark Waits while a writer is in, so the stamp is always even.
+ *         The data read may be torn, so readers must not follow pointers
+ *         or act on it before it is validated.
+ */
+long pthread_seqlock_read_begin(pthread_seqlock_t *lock)
+{
+    long stamp;
+
+    while ((stamp = atomic_read_acquire(& lock->sequence)) & 1)
+        cpu_relax();
+
+    return stamp;
+}
+
+/**
+ * Validate an optimistic read.
+ * @param  lock The sequence lock object.
+ * @param  stamp The stamp returned by pthread_seqlock_read_begin().
+ * @return Nonzero if no writer has been in since the stamp was taken, so
+ *         the data read is consistent; 0 if the read must be retried.
+ */
+int pthread_seqlock_read_validate(pthread_seqlock_t *lock, long stamp)
+{
+    /* The data loads must be done before we look at the sequence again. */
+    atomic_fence_acquire();
+    return atomic_read(& lock->sequence) == stamp;
+}
+
+/**
+ * Acquire a sequence lock for writing.
+ * @param  lock The sequence lock object.
+ * @return Always return 0.
+ */
+int pthread_seqlock_write_lock(pthread_seqlock_t *lock)
+{
+    pthread_spin_lock(& lock->lock);
+
+    /* Interlocked, so the odd sequence is visible before any data store. */
+    atomic_fetch_and_add(& lock->sequence, 1);
+
+    return 0;
+}
+
+/**
+ * Release a sequence lock for writing.
+ * @param  lock The sequence lock object.
+ * @return Always return 0.
+ */
+int pthread_seqlock_write_unlock(pthread_seqlock_t *lock)
+{
+    atomic_set_release(& lock->sequence, lock->sequence + 1);
+    pthread_spin_unlock(& lock->lock);
+
+    return 0;
+}
+
+/**
+ * Destroy a sequence lock (reset to unlocked state).
+ * @param  lock The sequence lock object.
+ * @return Always return 0.
+ */
+int pthread_seqlock_destroy(pthread_seqlock_t *lock)
+{
+    lock->sequence = 0;
+    return pthread_spin_destroy(& lock->lock);
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file slab.c
+ * @brief Implementation Code of the Internal Object Allocator
+ *
+ * Synchronization objects, thread objects, attribute objects and cleanup
+ * nodes are small and fixed-size, so they are served from size classes
+ * that are multiples of the cache line size, carved out of chunks obtained
+ * from VirtualAlloc(). Every object starts on its own cache line, so two
+ * hot objects never share one.
+ *
+ * Each thread keeps a magazine of free objects per class and only takes
+ * the depot lock of a class to move half a magazine at a time, so creating
+ * and destroying objects does not contend on the process heap lock.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+#define ARCH_SLAB_LINE      64
+#define ARCH_SLAB_CLASSES   4       /* 64, 128, 192 and 256 bytes */
+#define ARCH_SLAB_MAGAZINE  32      /* objects cached per thread and class */
+#define ARCH_SLAB_CHUNK     65536   /* the VirtualAlloc() granularity */
+
+typedef struct arch_slab_object {
+    struct arch_slab_object *next;
+} arch_slab_object;
+
+typedef struct arch_slab_chunk {
+    struct arch_slab_chunk *next;
+    long index;
+} arch_slab_chunk;
+
+typedef struct {
+    pthread_spinlock_t lock;
+    arch_slab_object *head;
+    long count;
+    char pad[ARCH_SLAB_LINE - sizeof(pthread_spinlock_t) - sizeof(void *) - sizeof(long)];
+} arch_slab_depot;
+
+typedef struct arch_slab_cache {
+    struct arch_slab_cache *next, *prev;
+    long count[ARCH_SLAB_CLASSES];
+    void *objects[ARCH_SLAB_CLASSES][ARCH_SLAB_MAGAZINE];
+} arch_slab_cache;
+
+static DWORD libpthread_slab_tls_index = TLS_OUT_OF_INDEXES;
+static arch_slab_depot libpthread_slab_depot[ARCH_SLAB_CLASSES];
+
+/* Chunks and per-thread caches, guarded by libpthread_slab_lock. */
+static pthread_spinlock_t libpthread_slab_lock = PTHREAD_SPINLOCK_INITIALIZER;
+static arch_slab_chunk *libpthread_slab_chunks;
+static arch_slab_cache *libpthread_slab_caches;
+static size_t libpthread_slab_reserved;
+
+static __inline int arch_slab_class_of(size_t size)
+{
+    return (int) ((size + ARCH_SLAB_LINE - 1) / ARCH_SLAB_LINE) - 1;
+}
+
+static __inline size_t arch_slab_size_of(int index)
+{
+    return (size_t) (index + 1) * ARCH_SLAB_LINE;
+}
+
+static arch_slab_cache *arch_slab_cache_self(void)
+{
+    arch_slab_cache *cache = TlsGetValue(libpthread_slab_tls_index);
+
+    if (cache != NULL)
+        return cache;
+
+    if ((cache = calloc(1, sizeof(arch_slab_cache))) == NULL)
+        return NULL;
+
+    pthread_spin_lock(& libpthread_slab_lock);
+    cache->next = libpthread_slab_caches;
+    if (cache->next != NULL)
+        cache->next->prev = cache;
+    libpthread_slab_caches = cache;
+    pthread_spin_unlock(& libpthread_slab_lock);
+
+    TlsSetValue(libpthread_slab_tls_index, cache);
+    return cache;
+}
+
+/*
+ * Carve a new chunk into objects of one class and hand them to the depot.
+ * The first line of the chunk links it for the footprint and for release.
+ */
+static int arch_slab_grow(int index)
+{
+    char *p, *end;
+    size_t size = arch_slab_size_of(index);
+    arch_slab_object *head = NULL, *tail = NULL, *obj;
+    arch_slab_chunk *chunk;
+    arch_slab_depot *depot = libpthread_slab_depot + index;
+    long n = 0;
+
+    chunk = VirtualAlloc(NULL, ARCH_SLAB_CHUNK, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (chunk == NULL)
+        return 0;
+
+    end = (char *) chunk + ARCH_SLAB_CHUNK;
+    for (p = (char *) chunk + ARCH_SLAB_LINE; p + size <= end; p += size, n++) {
+        obj = (arch_slab_object *) p;
+        obj->next = NULL;
+        if (tail != NULL) tail->next = obj;
+        else head = obj;
+        tail = obj;
+    }
+
+    pthread_spin_lock(& libpthread_slab_lock);
+    chunk->index = index;
+    chunk->next = libpthread_slab_chunks;
+    libpthread_slab_chunks = chunk;
+    libpthread_slab_reserved += ARCH_SLAB_CHUNK;
+    pthread_spin_unlock(& libpthread_slab_lock);
+
+    pthread_spin_lock(& depot->lock);
+    tail->next = depot->head;
+    depot->head = head;
+    depot->count += n;
+    pthread_spin_unlock(& depot->lock);
+
+    return 1;
+}
+
+/* Move up to half a magazine from the depot to the calling thread. */
+static long arch_slab_refill(arch_slab_cache *cache, int index)
+{
+    long n = 0;
+    arch_slab_object *obj;
+    arch_slab_depot *depot = libpthread_slab_depot + index;
+
+    while (1) {
+        pthread_spin_lock(& depot->lock);
+        while (n < ARCH_SLAB_MAGAZINE / 2 && (obj = depot->head) != NULL) {
+            depot->head = obj->next;
+            depot->count--;
+            cache->objects[index][n++] = obj;
+        }
+        pthread_spin_unlock(& depot->lock);
+
+        if (n > 0 || !arch_slab_grow(index))
+            break;
+    }
+
+    return cache->count[index] = n;
+}
+
+/* Move the oldest n objects of a magazine back to the depot. */
+static void arch_slab_flush(arch_slab_cache *cache, int index, long n)
+{
+    long i;
+    arch_slab_object *obj;
+    arch_slab_depot *depot = libpthread_slab_depot + index;
+
+    pthread_spin_lock(& depot->lock);
+    for (i = 0; i < n; i++) {
+        obj = cache->objects[index][i];
+        obj->next = depot->head;
+        depot->head = obj;
+    }
+    depot->count += n;
+    pthread_spin_unlock(& depot->lock);
+
+    cache->count[index] -= n;
+    memmove(cache->objects[index], cache->objects[index] + n, cache->count[index] * sizeof(void *));
+}
+
+/**
+ * Allocate a zero-filled internal object.
+ * @param size The size of the object.
+ * @return The cache-line aligned object, or NULL if out of memory.
+ */
+void *arch_slab_alloc(size_t size)
+{
+    void *obj;
+    arch_slab_cache *cache;
+    int index = arch_slab_class_of(size);
+
+    if (index >= ARCH_SLAB_CLASSES)
+        return calloc(1, size);
+
+    if ((cache = arch_slab_cache_self()) == NULL)
+        return NULL;
+
+    if (cache->count[index] == 0 && arch_slab_refill(cache, index) == 0)
+        return NULL;
+
+    obj = cache->objects[index][--cache->count[index]];
+    memset(obj, 0, arch_slab_size_of(index));
+    return obj;
+}
+
+/**
+ * Release an internal object.
+ * @param ptr The object returned by arch_slab_alloc(), or NULL.
+ * @param size The size passed to arch_slab_alloc().
+ */
+void arch_slab_free(void *ptr, size_t size)
+{
+    arch_slab_cache *cache;
+    int index = arch_slab_class_of(size);
+
+    if (ptr == NULL)
+        return;
+
+    if (index >= ARCH_SLAB_CLASSES) {
+        free(ptr);
+        return;
+    }
+
+    if ((cache = arch_slab_cache_self()) == NULL) {
+        /* No magazine for this thread, go straight to the depot. */
+        pthread_spin_lock(& libpthread_slab_depot[index].lock);
+        ((arch_slab_object *) ptr)->next = libpthread_slab_depot[index].head;
+        libpthread_slab_depot[index].head = ptr;
+        libpthread_slab_depot[index].count++;
+        pthread_spin_unlock(& libpthread_slab_depot[index].lock);
+        return;
+    }
+
+    if (cache->count[index] == ARCH_SLAB_MAGAZINE)
+        arch_slab_flush(cache, index, ARCH_SLAB_MAGAZINE / 2);
+
+    cache->objects[index][cache->count[index]++] = ptr;
+}
+
+/**
+ * Get the memory footprint of the internal object allocator.
+ * @param st The pointer of the structure to receive the footprint.
+ * @return If the function succeeds, the return value is 0.
+ *         Otherwise, EINVAL returned to indicate the error.
+ * @remark The figures are read without stopping other threads, so they
+ *         are exact only when no object is being created or destroyed.
+ */
+int pthread_memstat_np(pthread_memstat_np_t *st)
+{
+    int i;
+    size_t cached = 0, overhead;
+    arch_slab_cache *cache;
+    arch_slab_chunk *chunk;
+
+    if (st == NULL)
+        return EINVAL;
+
+    pthread_spin_lock(& libpthread_slab_lock);
+    st->reserved = libpthread_slab_reserved;
+
+    /* The chunk header line, and the tail that is too short for an object. */
+    overhead = 0;
+    for (chunk = libpthread_slab_chunks; chunk != NULL; chunk = chunk->next)
+        overhead += ARCH_SLAB_LINE + (ARCH_SLAB_CHUNK - ARCH_SLAB_LINE) % arch_slab_size_of(chunk->index);
+
+    for (cache = libpthread_slab_caches; cache != NULL; cache = cache->next) {
+        for (i = 0; i < ARCH_SLAB_CLASSES; i++)
+            cached += cache->count[i] * arch_slab_size_of(i);
+    }
+    pthread_spin_unlock(& libpthread_slab_lock);
+
+    for (i = 0; i < ARCH_SLAB_CLASSES; i++)
+        cached += atomic_read(& libpthread_slab_depot[i].count) * arch_slab_size_of(i);
+
+    st->cached = cached;
+    st->in_use = st->reserved > cached + overhead ? st->reserved - cached - overhead : 0;
+
+    return 0;
+}
+
+/**
+ * Return the magazines of the calling thread to the depots, called on
+ * thread detach.
+ */
+void arch_slab_thread_exit(void)
+{
+    int i;
+    arch_slab_cache *cache;
+
+    if (libpthread_slab_tls_index == TLS_OUT_OF_INDEXES)
+        return;
+
+    if ((cache = TlsGetValue(libpthread_slab_tls_index)) == NULL)
+        return;
+
+    for (i = 0; i < ARCH_SLAB_CLASSES; i++) {
+        if (cache->count[i] > 0)
+            arch_slab_flush(cache, i, cache->count[i]);
+    }
+
+    pthread_spin_lock(& libpthread_slab_lock);
+    if (cache->prev != NULL) cache->prev->next = cache->next;
+    else libpthread_slab_caches = cache->next;
+    if (cache->next != NULL) cache->next->prev = cache->prev;
+    pthread_spin_unlock(& libpthread_slab_lock);
+
+    TlsSetValue(libpthread_slab_tls_index, NULL);
+    free(cache);
+}
+
+int arch_slab_init(void)
+{
+    if ((libpthread_slab_tls_index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+        return 0;
+
+    return 1;
+}
+
+void arch_slab_fini(void)
+{
+    arch_slab_chunk *chunk, *next;
+
+    arch_slab_thread_exit();
+    TlsFree(libpthread_slab_tls_index);
+    libpthread_slab_tls_index = TLS_OUT_OF_INDEXES;
+
+    for (chunk = libpthread_slab_chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        VirtualFree(chunk, 0, MEM_RELEASE);
+    }
+    libpthread_slab_chunks = NULL;
+    libpthread_slab_reserved = 0;
+}
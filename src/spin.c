@@ -30,6 +30,19 @@
 #include "arch.h"
 #include "misc.h"
 
+/*
+ * A ticket lock tells every waiter how many threads are ahead of it, so it
+ * polls the owner field about once per handoff instead of continuously.
+ * A handoff costs about one cache line transfer plus a short critical
+ * section; ARCH_SPIN_SLOT_CYCLES estimates it, and the number of
+ * cpu_relax() per slot is calibrated from it when the library is loaded,
+ * as the cost of a pause differs by an order of magnitude between cores.
+ */
+#define ARCH_SPIN_SLOT_CYCLES   256
+#define ARCH_SPIN_SLOT_MAX      64
+
+static long libpthread_spin_slot = 1;
+
 /**
  * Initialize a spin lock.
  * @param  lock The spin lock object.
@@ -55,10 +68,13 @@ int pthread_spin_init(pthread_spinlock_t *lock, int pshared)
  */
 int pthread_spin_lock(pthread_spinlock_t *lock)
 {
-    long ticket = atomic_fetch_and_add(& lock->ticket, 1) ;
+    long ticket = atomic_fetch_and_add(& lock->ticket, 1), distance, i;
 
-    while (atomic_read(& lock->owner) != ticket)
-        cpu_relax();
+    /* Back off in proportion to our place in the queue, the next in line polls. */
+    while ((distance = ticket - atomic_read(& lock->owner)) != 0) {
+        for (i = (distance - 1) * libpthread_spin_slot + 1; i > 0; i--)
+            cpu_relax();
+    }
 
     return 0;
 }
@@ -104,3 +120,23 @@ int pthread_spin_destroy(pthread_spinlock_t *lock)
 
     return 0;
 }
+
+/**
+ * Calibrate the backoff slot of pthread_spin_lock(), called on process attach.
+ */
+void arch_spin_init(void)
+{
+    int i;
+    unsigned __int64 start, cycles;
+
+    start = arch_cycles();
+    for (i = 0; i < 1000; i++)
+        cpu_relax();
+    cycles = (arch_cycles() - start) / 1000;
+
+    if (cycles == 0)
+        cycles = 1;
+    libpthread_spin_slot = (long) (ARCH_SPIN_SLOT_CYCLES / cycles);
+    if (libpthread_spin_slot < 1) libpthread_spin_slot = 1;
+    if (libpthread_spin_slot > ARCH_SPIN_SLOT_MAX) libpthread_spin_slot = ARCH_SPIN_SLOT_MAX;
+}
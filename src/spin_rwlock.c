@@ -20,6 +20,17 @@
 /**
  * @file spin_rwlock.c
  * @brief Implementation Code of Spin RWLock Routines
+ *
+ * Writers are served in FIFO order through the ticket/owner pair. A writer
+ * whose turn has come sets ARCH_SPIN_RWLOCK_WRITER in the readers word and
+ * waits for the readers to drain. Readers increment the readers word and
+ * are done unless that bit is set; only then do they take a ticket and
+ * queue behind the writer. Without a writer, a reader costs one atomic.
+ *
+ * An upgradable reader takes a turn like a writer, which keeps writers and
+ * other upgradable readers out, but only counts itself as a reader, so
+ * plain readers still get in. Since it already owns the turn, it can
+ * become the writer without racing anybody.
  */
 
 #include <pthread.h>
@@ -57,7 +68,15 @@ int pthread_spin_rwlock_init(pthread_spin_rwlock_t *lock, int pshared)
  */
 int pthread_spin_rwlock_reader_lock(pthread_spin_rwlock_t *lock)
 {
-    int id = atomic_fetch_and_add(& lock->ticket, 1);
+    int id;
+
+    if ((atomic_fetch_and_add(& lock->readers, 1) & ARCH_SPIN_RWLOCK_WRITER) == 0)
+        return 0;
+
+    /* A writer is in, back out and queue behind it. */
+    atomic_fetch_and_add(& lock->readers, -1);
+
+    id = atomic_fetch_and_add(& lock->ticket, 1);
     while (atomic_read(& lock->owner) != id)
         cpu_relax();
 
@@ -90,7 +109,9 @@ int pthread_spin_rwlock_writer_lock(pthread_spin_rwlock_t *lock)
     while (atomic_read(& lock->owner) != id)
         cpu_relax();
 
-    while (atomic_read(& lock->readers) > 0)
+    /* Turn new readers away, then wait for those already in. */
+    atomic_fetch_and_add(& lock->readers, ARCH_SPIN_RWLOCK_WRITER);
+    while (atomic_read(& lock->readers) != ARCH_SPIN_RWLOCK_WRITER)
         cpu_relax();
 
     return 0;
@@ -103,6 +124,73 @@ int pthread_spin_rwlock_writer_lock(pthread_spin_rwlock_t *lock)
  */
 int pthread_spin_rwlock_writer_unlock(pthread_spin_rwlock_t *lock)
 {
+    atomic_fetch_and_add(& lock->readers, -ARCH_SPIN_RWLOCK_WRITER);
+    lock->owner++;
+
+    return 0;
+}
+
+/**
+ * Acquire a spin rwlock as the upgradable reader.
+ * @param  lock The spin rwlock object.
+ * @return Always return 0.
+ * @remark At most one thread holds the lock upgradable, along with any
+ *         number of plain readers. Release it with
+ *         pthread_spin_rwlock_upgradable_unlock(), or turn it into the
+ *         writer lock with pthread_spin_rwlock_upgrade().
+ */
+int pthread_spin_rwlock_upgradable_lock(pthread_spin_rwlock_t *lock)
+{
+    int id = atomic_fetch_and_add(& lock->ticket, 1);
+    while (atomic_read(& lock->owner) != id)
+        cpu_relax();
+
+    atomic_fetch_and_add(& lock->readers, 1);
+
+    return 0;
+}
+
+/**
+ * Release an upgradable spin rwlock.
+ * @param  lock The spin rwlock object.
+ * @return Always return 0.
+ */
+int pthread_spin_rwlock_upgradable_unlock(pthread_spin_rwlock_t *lock)
+{
+    atomic_fetch_and_add(& lock->readers, -1);
+    lock->owner++;
+
+    return 0;
+}
+
+/**
+ * Turn an upgradable reader lock into the writer lock.
+ * @param  lock The spin rwlock object, held upgradable by the caller.
+ * @return Always return 0.
+ * @remark No writer can get in between, so what was read under the
+ *         upgradable lock is still valid. Release the lock with
+ *         pthread_spin_rwlock_writer_unlock() or downgrade it again.
+ */
+int pthread_spin_rwlock_upgrade(pthread_spin_rwlock_t *lock)
+{
+    /* Stop counting ourselves as a reader and turn new readers away at once. */
+    atomic_fetch_and_add(& lock->readers, ARCH_SPIN_RWLOCK_WRITER - 1);
+    while (atomic_read(& lock->readers) != ARCH_SPIN_RWLOCK_WRITER)
+        cpu_relax();
+
+    return 0;
+}
+
+/**
+ * Turn the writer lock into a reader lock.
+ * @param  lock The spin rwlock object, held for writing by the caller.
+ * @return Always return 0.
+ * @remark Readers and the next writer in line may get in from now on,
+ *         release the lock with pthread_spin_rwlock_reader_unlock().
+ */
+int pthread_spin_rwlock_downgrade(pthread_spin_rwlock_t *lock)
+{
+    atomic_fetch_and_add(& lock->readers, 1 - ARCH_SPIN_RWLOCK_WRITER);
     lock->owner++;
 
     return 0;
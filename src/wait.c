@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file wait.c
+ * @brief Implementation Code of Address-keyed Wait/Wake Routines
+ *
+ * Threads block on the address of a 32-bit word instead of on a kernel
+ * object owned by the synchronization primitive, so primitives need no
+ * handles at all. On Windows 8 or later we use WaitOnAddress() and
+ * WakeByAddressSingle()/WakeByAddressAll(), which are resolved at run time.
+ * On older systems we fall back to a hashed table of FIFO wait queues,
+ * where every blocked thread sleeps on its own auto-reset event, which is
+ * created once per thread rather than once per primitive.
+ *
+ * Primitives that spin before they block ask arch_wait_spin_cycles() for
+ * the spin time of their wait policy, which is calibrated at load time.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winsock2.h>
+
+#include "arch.h"
+#include "misc.h"
+
+#define ARCH_WAIT_BUCKETS   256 /* must be power of 2 */
+#define ARCH_WAIT_SPIN_US   50      /* PTHREAD_WAIT_POLICY_DEFAULT_NP spin time */
+#define ARCH_WAIT_ACTIVE_US 5000    /* PTHREAD_WAIT_POLICY_ACTIVE_NP spin time */
+
+typedef BOOL (WINAPI *wait_on_address_t)(volatile VOID *, PVOID, SIZE_T, DWORD);
+typedef VOID (WINAPI *wake_by_address_t)(PVOID);
+typedef VOID (WINAPI *get_precise_time_t)(FILETIME *);
+
+typedef struct arch_wait_node {
+    volatile long *addr;
+    struct arch_wait_node *next, *prev;
+    struct arch_wait_node *wake_next;
+    long signaled;
+    HANDLE event;
+} arch_wait_node;
+
+typedef struct {
+    pthread_spinlock_t lock;
+    arch_wait_node *head, *tail;
+    char pad[64 - sizeof(pthread_spinlock_t) - 2 * sizeof(void *)];
+} arch_wait_bucket;
+
+static wait_on_address_t libpthread_wait_on_address;
+static wake_by_address_t libpthread_wake_by_address_single;
+static wake_by_address_t libpthread_wake_by_address_all;
+static get_precise_time_t libpthread_get_precise_time;
+
+static DWORD libpthread_wait_tls_index = TLS_OUT_OF_INDEXES;
+static unsigned __int64 libpthread_cycles_per_us = 1000;
+static int libpthread_wait_policy = PTHREAD_WAIT_POLICY_DEFAULT_NP;
+static long libpthread_wait_spin_us = ARCH_WAIT_SPIN_US;
+static arch_wait_bucket libpthread_wait_table[ARCH_WAIT_BUCKETS];
+
+static __inline arch_wait_bucket *arch_wait_bucket_of(volatile long *addr)
+{
+    uintptr_t key = (uintptr_t) addr;
+
+    key ^= key >> 12;
+    return libpthread_wait_table + ((key >> 2) & (ARCH_WAIT_BUCKETS - 1));
+}
+
+static arch_wait_node *arch_wait_node_self(void)
+{
+    arch_wait_node *node = TlsGetValue(libpthread_wait_tls_index);
+
+    if (node != NULL)
+        return node;
+
+    if ((node = calloc(1, sizeof(arch_wait_node))) == NULL)
+        return NULL;
+
+    if ((node->event = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) {
+        free(node);
+        return NULL;
+    }
+
+    TlsSetValue(libpthread_wait_tls_index, node);
+    return node;
+}
+
+static __inline void arch_wait_unlink(arch_wait_bucket *b, arch_wait_node *node)
+{
+    if (node->prev != NULL) node->prev->next = node->next;
+    else b->head = node->next;
+
+    if (node->next != NULL) node->next->prev = node->prev;
+    else b->tail = node->prev;
+
+    node->next = node->prev = NULL;
+}
+
+static int arch_wait_on_queue(volatile long *addr, long compare, DWORD ms)
+{
+    arch_wait_bucket *b;
+    arch_wait_node *node = arch_wait_node_self();
+
+    if (node == NULL) {
+        /* Out of resources, degrade to a spurious wakeup. */
+        SwitchToThread();
+        return 0;
+    }
+
+    b = arch_wait_bucket_of(addr);
+    pthread_spin_lock(& b->lock);
+    if (atomic_read(addr) != compare) {
+        pthread_spin_unlock(& b->lock);
+        return 0;
+    }
+
+    node->addr = addr;
+    node->signaled = 0;
+    node->next = NULL;
+    node->prev = b->tail;
+    if (b->tail != NULL) b->tail->next = node;
+    else b->head = node;
+    b->tail = node;
+    pthread_spin_unlock(& b->lock);
+
+    if (WaitForSingleObject(node->event, ms) == WAIT_OBJECT_0)
+        return 0;
+
+    pthread_spin_lock(& b->lock);
+    if (!node->signaled) {
+        arch_wait_unlink(b, node);
+        pthread_spin_unlock(& b->lock);
+        return ETIMEDOUT;
+    }
+    pthread_spin_unlock(& b->lock);
+
+    /* A waker already dequeued us, consume its SetEvent. */
+    (void) WaitForSingleObject(node->event, INFINITE);
+    return 0;
+}
+
+static void arch_wake_queue(volatile long *addr, long count)
+{
+    arch_wait_node *node, *next, *list = NULL;
+    arch_wait_bucket *b = arch_wait_bucket_of(addr);
+
+    pthread_spin_lock(& b->lock);
+    for (node = b->head; node != NULL && count > 0; node = next) {
+        next = node->next;
+        if (node->addr != addr)
+            continue;
+
+        arch_wait_unlink(b, node);
+        node->signaled = 1;
+        node->wake_next = list;
+        list = node;
+        count--;
+    }
+    pthread_spin_unlock(& b->lock);
+
+    while (list != NULL) {
+        next = list->wake_next;
+        SetEvent(list->event);
+        list = next;
+    }
+}
+
+/**
+ * Block the calling thread while the word at addr equals compare.
+ * @param addr The address of the word to wait on.
+ * @param compare The value the word is expected to hold.
+ * @param ms The time-out interval in milliseconds, or INFINITE.
+ * @return 0 if woken (possibly spuriously) or the word did not match,
+ *         ETIMEDOUT if the interval elapsed.
+ */
+int arch_wait_on_address(volatile long *addr, long compare, DWORD ms)
+{
+    if (libpthread_wait_on_address != NULL) {
+        if (libpthread_wait_on_address(addr, &compare, sizeof(long), ms))
+            return 0;
+        return GetLastError() == ERROR_TIMEOUT ? ETIMEDOUT : 0;
+    }
+
+    return arch_wait_on_queue(addr, compare, ms);
+}
+
+/**
+ * Wake threads blocked on addr.
+ * @param addr The address of the word.
+ * @param count The maximum number of threads to wake, or ARCH_WAKE_ALL.
+ */
+void arch_wake_by_address(volatile long *addr, long count)
+{
+    if (libpthread_wake_by_address_single != NULL) {
+        if (count == ARCH_WAKE_ALL)
+            libpthread_wake_by_address_all((PVOID) addr);
+        else while (count-- > 0)
+            libpthread_wake_by_address_single((PVOID) addr);
+        return;
+    }
+
+    arch_wake_queue(addr, count);
+}
+
+/**
+ * Get the time remaining until an absolute CLOCK_REALTIME deadline.
+ * @param ts The absolute deadline.
+ * @return The remaining time in 100-nanoseconds, or a value <= 0 if the
+ *         deadline has passed.
+ * @remark GetSystemTimePreciseAsFileTime() is used when available, so
+ *         deadlines are not truncated to the system tick.
+ */
+__int64 arch_rel_time_in_100ns(const struct timespec *ts)
+{
+    FILETIME now;
+
+    if (libpthread_get_precise_time != NULL)
+        libpthread_get_precise_time(&now);
+    else
+        GetSystemTimeAsFileTime(&now);
+
+    return ts->tv_sec * POW10_7 + ts->tv_nsec / 100 - FileTimeToUnixTimeIn100NS(&now);
+}
+
+/**
+ * Get how long a waiter spins before it blocks.
+ * @param policy One of PTHREAD_WAIT_POLICY_*_NP.
+ * @return The spin time in arch_cycles() units, 0 to block at once.
+ * @remark PTHREAD_WAIT_POLICY_DEFAULT_NP takes the process policy from the
+ *         LIBPTHREAD_WAIT_POLICY environment variable (ACTIVE or PASSIVE, as
+ *         OMP_WAIT_POLICY), and LIBPTHREAD_SPIN_US sets its spin time.
+ */
+unsigned __int64 arch_wait_spin_cycles(int policy)
+{
+    if (policy == PTHREAD_WAIT_POLICY_DEFAULT_NP)
+        policy = libpthread_wait_policy;
+
+    if (policy == PTHREAD_WAIT_POLICY_PASSIVE_NP)
+        return 0;
+
+    if (policy == PTHREAD_WAIT_POLICY_ACTIVE_NP)
+        return ARCH_WAIT_ACTIVE_US * libpthread_cycles_per_us;
+
+    return libpthread_wait_spin_us * libpthread_cycles_per_us;
+}
+
+/* Measure arch_cycles() against the performance counter for about 100 us. */
+static void arch_wait_calibrate(void)
+{
+    LARGE_INTEGER pf, start, now;
+    unsigned __int64 cycles;
+
+    if (!QueryPerformanceFrequency(& pf) || pf.QuadPart < POW10_4)
+        return;
+
+    QueryPerformanceCounter(& start);
+    cycles = arch_cycles();
+    do {
+        cpu_relax();
+        QueryPerformanceCounter(& now);
+    } while ((now.QuadPart - start.QuadPart) * POW10_4 < pf.QuadPart);
+
+    cycles = (arch_cycles() - cycles) * pf.QuadPart / ((now.QuadPart - start.QuadPart) * 1000000);
+    if (cycles > 0)
+        libpthread_cycles_per_us = cycles;
+}
+
+static void arch_wait_read_policy(void)
+{
+    char buf[32];
+    DWORD n;
+
+    n = GetEnvironmentVariableA("LIBPTHREAD_WAIT_POLICY", buf, sizeof(buf));
+    if (n > 0 && n < sizeof(buf)) {
+        if (_stricmp(buf, "ACTIVE") == 0)
+            libpthread_wait_policy = PTHREAD_WAIT_POLICY_ACTIVE_NP;
+        else if (_stricmp(buf, "PASSIVE") == 0)
+            libpthread_wait_policy = PTHREAD_WAIT_POLICY_PASSIVE_NP;
+    }
+
+    n = GetEnvironmentVariableA("LIBPTHREAD_SPIN_US", buf, sizeof(buf));
+    if (n > 0 && n < sizeof(buf) && atol(buf) >= 0)
+        libpthread_wait_spin_us = atol(buf);
+}
+
+/**
+ * Release the wait node of the calling thread, called on thread detach.
+ */
+void arch_wait_thread_exit(void)
+{
+    arch_wait_node *node;
+
+    if (libpthread_wait_tls_index == TLS_OUT_OF_INDEXES)
+        return;
+
+    if ((node = TlsGetValue(libpthread_wait_tls_index)) != NULL) {
+        CloseHandle(node->event);
+        free(node);
+        TlsSetValue(libpthread_wait_tls_index, NULL);
+    }
+}
+
+int arch_wait_init(void)
+{
+    HMODULE kernel = GetModuleHandleA("kernelbase.dll");
+
+    if (kernel != NULL) {
+        libpthread_wait_on_address = (wait_on_address_t) GetProcAddress(kernel, "WaitOnAddress");
+        libpthread_wake_by_address_single = (wake_by_address_t) GetProcAddress(kernel, "WakeByAddressSingle");
+        libpthread_wake_by_address_all = (wake_by_address_t) GetProcAddress(kernel, "WakeByAddressAll");
+
+        if (libpthread_wait_on_address == NULL || libpthread_wake_by_address_single == NULL
+            || libpthread_wake_by_address_all == NULL) {
+            libpthread_wait_on_address = NULL;
+            libpthread_wake_by_address_single = NULL;
+            libpthread_wake_by_address_all = NULL;
+        }
+
+        libpthread_get_precise_time = (get_precise_time_t) GetProcAddress(kernel, "GetSystemTimePreciseAsFileTime");
+    }
+
+    arch_wait_calibrate();
+    arch_wait_read_policy();
+
+    if ((libpthread_wait_tls_index = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+        return 0;
+
+    return 1;
+}
+
+void arch_wait_fini(void)
+{
+    arch_wait_thread_exit();
+    TlsFree(libpthread_wait_tls_index);
+    libpthread_wait_tls_index = TLS_OUT_OF_INDEXES;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_THREADS    24
+#define TEST_LOOPS      10000
+
+pthread_barrier_t barrier;
+
+/* Every thread writes its slot for the phase, then checks all the others. */
+static volatile long phases[TEST_THREADS];
+static volatile long serials;
+
+static void *arrive_and_check(void *arg)
+{
+    int i, j, rc;
+    uintptr_t self = (uintptr_t) arg;
+
+    for (i = 1; i <= TEST_LOOPS; i++) {
+        phases[self] = i;
+        rc = pthread_barrier_wait(&barrier);
+        assert(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+        if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+            atomic_fetch_and_add(&serials, 1);
+        for (j = 0; j < TEST_THREADS; j++)
+            assert(phases[j] >= i);
+        /* nobody may start the next phase before everyone checked */
+        pthread_barrier_wait(&barrier);
+    }
+
+    return NULL;
+}
+
+/* Arrive, work while the others arrive, then wait for the phase. */
+static void *arrive_work_wait(void *arg)
+{
+    int i, j, rc;
+    long token;
+    volatile long work = 0;
+    uintptr_t self = (uintptr_t) arg;
+
+    for (i = 1; i <= TEST_LOOPS; i++) {
+        phases[self] = i;
+        rc = pthread_barrier_arrive_np(&barrier, &token);
+        assert(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+        if (rc == PTHREAD_BARRIER_SERIAL_THREAD)
+            atomic_fetch_and_add(&serials, 1);
+        for (j = 0; j < (int) self * 10; j++)
+            work++;
+        assert(pthread_barrier_wait_token_np(&barrier, token) == 0);
+        for (j = 0; j < TEST_THREADS; j++)
+            assert(phases[j] >= i);
+        pthread_barrier_wait(&barrier);
+    }
+
+    return NULL;
+}
+
+static int64_t max_of(int64_t a, int64_t b)
+{
+    return a > b ? a : b;
+}
+
+/* Every thread gets the reduction of all the values of the phase. */
+static void *reduce_and_check(void *arg)
+{
+    int i, rc;
+    int64_t self = (uintptr_t) arg, result;
+
+    for (i = 1; i <= TEST_LOOPS / 10; i++) {
+        rc = pthread_barrier_reduce_np(&barrier, self + i, PTHREAD_REDUCE_SUM_NP, NULL, &result);
+        assert(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+        assert(result == (int64_t) TEST_THREADS * (TEST_THREADS - 1) / 2 + (int64_t) TEST_THREADS * i);
+
+        assert(pthread_barrier_reduce_np(&barrier, self - i, PTHREAD_REDUCE_MIN_NP, NULL, &result) >= 0);
+        assert(result == -i);
+
+        assert(pthread_barrier_reduce_np(&barrier, self * i, PTHREAD_REDUCE_CUSTOM_NP, max_of, &result) >= 0);
+        assert(result == (int64_t) (TEST_THREADS - 1) * i);
+    }
+
+    return NULL;
+}
+
+static void run_threads(int policy, int type)
+{
+    uintptr_t i;
+    pthread_t threads[TEST_THREADS];
+    pthread_barrierattr_t attr;
+
+    assert(pthread_barrierattr_init(&attr) == 0);
+    assert(pthread_barrierattr_setwaitpolicy_np(&attr, policy) == 0);
+    assert(pthread_barrierattr_settype_np(&attr, type) == 0);
+    assert(pthread_barrier_init(&barrier, &attr, TEST_THREADS) == 0);
+    assert(pthread_barrierattr_destroy(&attr) == 0);
+
+    serials = 0;
+    for (i = 0; i < TEST_THREADS; i++)
+        phases[i] = 0;
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, arrive_and_check, (void *) i) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(serials == TEST_LOOPS);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, reduce_and_check, (void *) i) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    serials = 0;
+    for (i = 0; i < TEST_THREADS; i++)
+        phases[i] = 0;
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, arrive_work_wait, (void *) i) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(serials == TEST_LOOPS);
+
+    assert(pthread_barrier_destroy(&barrier) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    int value;
+    long token;
+    int64_t result;
+    pthread_barrierattr_t attr;
+
+    assert(pthread_barrierattr_init(&attr) == 0);
+    printf("pthread_barrierattr_init passed\n");
+
+    assert(pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_PRIVATE) == 0);
+    assert(pthread_barrierattr_getpshared(&attr, &value) == 0);
+    assert(value == PTHREAD_PROCESS_PRIVATE);
+    printf("pthread_barrierattr_getpshared passed\n");
+
+    assert(pthread_barrierattr_getwaitpolicy_np(&attr, &value) == 0);
+    assert(value == PTHREAD_WAIT_POLICY_DEFAULT_NP);
+    assert(pthread_barrierattr_setwaitpolicy_np(&attr, 3) == EINVAL);
+    assert(pthread_barrierattr_setwaitpolicy_np(&attr, PTHREAD_WAIT_POLICY_PASSIVE_NP) == 0);
+    assert(pthread_barrierattr_getwaitpolicy_np(&attr, &value) == 0);
+    assert(value == PTHREAD_WAIT_POLICY_PASSIVE_NP);
+    printf("pthread_barrierattr_setwaitpolicy_np passed\n");
+
+    assert(pthread_barrierattr_gettype_np(&attr, &value) == 0);
+    assert(value == PTHREAD_BARRIER_DEFAULT_NP);
+    assert(pthread_barrierattr_settype_np(&attr, 3) == EINVAL);
+    assert(pthread_barrierattr_settype_np(&attr, PTHREAD_BARRIER_TREE_NP) == 0);
+    assert(pthread_barrierattr_gettype_np(&attr, &value) == 0);
+    assert(value == PTHREAD_BARRIER_TREE_NP);
+    printf("pthread_barrierattr_settype_np passed\n");
+
+    assert(pthread_barrierattr_destroy(&attr) == 0);
+    printf("pthread_barrierattr_destroy passed\n");
+
+    assert(pthread_barrier_init(&barrier, NULL, 0) == -1);
+    assert(pthread_barrier_init(&barrier, NULL, 1) == 0);
+    assert(pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD);
+    printf("pthread_barrier_wait passed\n");
+
+    assert(pthread_barrier_reduce_np(&barrier, 7, PTHREAD_REDUCE_MAX_NP, NULL, &result) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(result == 7);
+    assert(pthread_barrier_reduce_np(&barrier, 7, PTHREAD_REDUCE_CUSTOM_NP, NULL, &result) == -1);
+    assert(pthread_barrier_reduce_np(&barrier, 7, 4, NULL, &result) == -1);
+    assert(pthread_barrier_destroy(&barrier) == 0);
+    printf("pthread_barrier_reduce_np passed\n");
+
+    assert(pthread_barrier_init(&barrier, NULL, 1) == 0);
+    assert(pthread_barrier_arrive_np(&barrier, &token) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(pthread_barrier_wait_token_np(&barrier, token) == 0);
+    assert(pthread_barrier_destroy(&barrier) == 0);
+    printf("pthread_barrier_arrive_np passed\n");
+
+    run_threads(PTHREAD_WAIT_POLICY_DEFAULT_NP, PTHREAD_BARRIER_FLAT_NP);
+    printf("pthread_barrier default policy passed\n");
+
+    run_threads(PTHREAD_WAIT_POLICY_PASSIVE_NP, PTHREAD_BARRIER_FLAT_NP);
+    printf("pthread_barrier passive policy passed\n");
+
+    run_threads(PTHREAD_WAIT_POLICY_ACTIVE_NP, PTHREAD_BARRIER_FLAT_NP);
+    printf("pthread_barrier active policy passed\n");
+
+    run_threads(PTHREAD_WAIT_POLICY_DEFAULT_NP, PTHREAD_BARRIER_TREE_NP);
+    run_threads(PTHREAD_WAIT_POLICY_PASSIVE_NP, PTHREAD_BARRIER_TREE_NP);
+    printf("pthread_barrier tree passed\n");
+
+    return 0;
+}
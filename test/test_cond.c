@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+#include <pthread_clock.h>
+
+#include "../src/misc.h"
+
+#define TEST_WAITERS    32
+
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+
+static volatile long waiting, go, woken;
+
+static void *wait_for_go(void *arg)
+{
+    assert(pthread_mutex_lock(&g_mutex) == 0);
+    waiting++;
+    while (!go)
+        assert(pthread_cond_wait(&g_cond, &g_mutex) == 0);
+    woken++;
+    assert(pthread_mutex_unlock(&g_mutex) == 0);
+
+    return NULL;
+}
+
+static void wait_for_waiters(long n)
+{
+    while (1) {
+        pthread_mutex_lock(&g_mutex);
+        if (waiting == n) {
+            pthread_mutex_unlock(&g_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&g_mutex);
+        Sleep(1);
+    }
+
+    /* the last one may still be on its way into pthread_cond_wait */
+    Sleep(10);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, type;
+    clockid_t clock_id;
+    pthread_t threads[TEST_WAITERS];
+    pthread_condattr_t attr;
+    pthread_mutexattr_t mattr;
+    pthread_cond_t cond;
+    pthread_mutex_t mutex;
+    struct timespec tp;
+
+    /* attributes */
+    assert(pthread_condattr_init(&attr) == 0);
+    assert(pthread_condattr_getclock(&attr, &clock_id) == 0 && clock_id == CLOCK_REALTIME);
+    assert(pthread_condattr_setclock(&attr, CLOCK_PROCESS_CPUTIME_ID) == EINVAL);
+    assert(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+    assert(pthread_condattr_getclock(&attr, &clock_id) == 0 && clock_id == CLOCK_MONOTONIC);
+    assert(pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == ENOTSUP);
+    printf("pthread_condattr passed\n");
+
+    /* CLOCK_MONOTONIC time-out, the mutex is held again on return */
+    assert(pthread_cond_init(&cond, &attr) == 0);
+    assert(pthread_condattr_destroy(&attr) == 0);
+    assert(pthread_mutex_init(&mutex, NULL) == 0);
+    assert(pthread_mutex_lock(&mutex) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    tp.tv_nsec += 20000000;
+    if (tp.tv_nsec >= POW10_9) {
+        tp.tv_nsec -= POW10_9;
+        tp.tv_sec += 1;
+    }
+    assert(pthread_cond_timedwait(&cond, &mutex, &tp) == ETIMEDOUT);
+    assert(pthread_mutex_trylock(&mutex) == EBUSY);
+    assert(pthread_mutex_unlock(&mutex) == 0);
+    assert(pthread_cond_destroy(&cond) == 0);
+    assert(pthread_mutex_destroy(&mutex) == 0);
+    printf("pthread_cond_timedwait passed\n");
+
+    /* an errorcheck mutex not held by the caller */
+    assert(pthread_mutexattr_init(&mattr) == 0);
+    assert(pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_ERRORCHECK) == 0);
+    assert(pthread_mutex_init(&mutex, &mattr) == 0);
+    assert(pthread_mutexattr_destroy(&mattr) == 0);
+    assert(pthread_cond_init(&cond, NULL) == 0);
+    assert(pthread_cond_wait(&cond, &mutex) == EPERM);
+    assert(pthread_cond_destroy(&cond) == 0);
+    assert(pthread_mutex_destroy(&mutex) == 0);
+    printf("pthread_cond_wait EPERM passed\n");
+
+    /* signal wakes exactly one waiter */
+    for (i = 0; i < 2; i++)
+        assert(pthread_create(&threads[i], NULL, wait_for_go, NULL) == 0);
+    wait_for_waiters(2);
+    assert(pthread_mutex_lock(&g_mutex) == 0);
+    go = 1;
+    assert(pthread_cond_signal(&g_cond) == 0);
+    assert(pthread_mutex_unlock(&g_mutex) == 0);
+    while (atomic_read(&woken) == 0)
+        Sleep(1);
+    Sleep(10);
+    assert(woken == 1);
+    assert(pthread_cond_signal(&g_cond) == 0);
+    for (i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+    assert(woken == 2);
+    printf("pthread_cond_signal passed\n");
+
+    /* broadcast, with and without holding the mutex, on each mutex type */
+    for (type = PTHREAD_MUTEX_NORMAL; type <= PTHREAD_MUTEX_HANDOFF_NP; type++) {
+        assert(pthread_mutex_destroy(&g_mutex) == 0);
+        assert(pthread_mutexattr_init(&mattr) == 0);
+        assert(pthread_mutexattr_settype(&mattr, type) == 0);
+        assert(pthread_mutex_init(&g_mutex, &mattr) == 0);
+        assert(pthread_mutexattr_destroy(&mattr) == 0);
+
+        waiting = go = woken = 0;
+        for (i = 0; i < TEST_WAITERS; i++)
+            assert(pthread_create(&threads[i], NULL, wait_for_go, NULL) == 0);
+        wait_for_waiters(TEST_WAITERS);
+
+        if (type & 1) {
+            assert(pthread_mutex_lock(&g_mutex) == 0);
+            go = 1;
+            assert(pthread_cond_broadcast(&g_cond) == 0);
+            assert(pthread_mutex_unlock(&g_mutex) == 0);
+        } else {
+            go = 1;
+            assert(pthread_cond_broadcast(&g_cond) == 0);
+        }
+
+        for (i = 0; i < TEST_WAITERS; i++)
+            pthread_join(threads[i], NULL);
+        assert(woken == TEST_WAITERS);
+        printf("pthread_cond_broadcast type %d passed\n", type);
+    }
+
+    assert(pthread_cond_destroy(&g_cond) == 0);
+    assert(pthread_mutex_destroy(&g_mutex) == 0);
+
+    return 0;
+}
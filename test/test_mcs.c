@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_THREADS    8
+
+pthread_mcs_lock_t lock = PTHREAD_MCS_LOCK_INITIALIZER;
+pthread_mcs_lock_t inner;
+
+/* Each waiter logs the place it got in, which must be its place in the queue. */
+static uintptr_t queue_order[TEST_THREADS];
+static long queue_len;
+
+static void *queue_behind(void *arg)
+{
+    assert(pthread_mcs_lock(&lock) == 0);
+    queue_order[queue_len++] = (uintptr_t) arg;
+
+    /* nested, takes a second node from the pool while the first is queued on */
+    assert(pthread_mcs_lock(&inner) == 0);
+    assert(pthread_mcs_unlock(&inner) == 0);
+    assert(pthread_mcs_unlock(&lock) == 0);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    uintptr_t i;
+    void *tail;
+    pthread_t threads[TEST_THREADS];
+
+    assert(pthread_mcs_init(&inner, PTHREAD_PROCESS_SHARED) == EINVAL);
+    assert(pthread_mcs_init(&inner, PTHREAD_PROCESS_PRIVATE) == 0);
+    printf("pthread_mcs_init passed\n");
+
+    assert(pthread_mcs_lock(&lock) == 0);
+    printf("pthread_mcs_lock passed\n");
+
+    assert(pthread_mcs_trylock(&lock) == EBUSY);
+    assert(pthread_mcs_trylock(&inner) == 0);
+    assert(pthread_mcs_unlock(&inner) == 0);
+    printf("pthread_mcs_trylock passed\n");
+
+    assert(pthread_mcs_unlock(&lock) == 0);
+    assert(pthread_mcs_unlock(&lock) == EPERM);
+    assert(pthread_mcs_unlock(&inner) == EPERM);
+    printf("pthread_mcs_unlock passed\n");
+
+    /* Waiters enqueue one at a time behind the holder and are handed the lock in that order. */
+    assert(pthread_mcs_lock(&lock) == 0);
+    for (i = 0; i < TEST_THREADS; i++) {
+        tail = lock.tail;
+        assert(pthread_create(&threads[i], NULL, queue_behind, (void *) i) == 0);
+        while (*(void * volatile *) & lock.tail == tail)
+            cpu_relax();
+    }
+    assert(pthread_mcs_trylock(&lock) == EBUSY);
+    assert(pthread_mcs_unlock(&lock) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(queue_len == TEST_THREADS && lock.tail == NULL && lock.owner == NULL);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(queue_order[i] == i);
+    printf("pthread_mcs_lock queue order passed\n");
+
+    assert(pthread_mcs_destroy(&inner) == 0);
+    assert(pthread_mcs_destroy(&lock) == 0);
+    printf("pthread_mcs_destroy passed\n");
+
+    return 0;
+}
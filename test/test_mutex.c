@@ -20,6 +20,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <winsock2.h>
 
@@ -27,15 +28,37 @@
 
 pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+#ifdef LIBPTHREAD_INLINE_MUTEX
+static void *lock_and_unlock(void *arg)
+{
+    assert(pthread_mutex_lock((pthread_mutex_t *) arg) == 0);
+    assert(pthread_mutex_unlock((pthread_mutex_t *) arg) == 0);
+    return NULL;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
-    int rc;
+    int rc, type, total;
     pthread_mutex_t mutex;
+    pthread_lockstat_np_t stats[8];
+#ifdef LIBPTHREAD_LOCKSTAT
+    int i;
+#endif
+#ifdef LIBPTHREAD_INLINE_MUTEX
+    pthread_t thread;
+#endif
+    pthread_mutexattr_t attr;
+    struct timespec tp;
 
     /* static initializer test */
+#ifndef LIBPTHREAD_INLINE_MUTEX
     printf("g_mutex: %p, & g_mutex: %p\n", g_mutex, &g_mutex);
+#endif
     rc = pthread_mutex_lock(&g_mutex);
+#ifndef LIBPTHREAD_INLINE_MUTEX
     printf("g_mutex: %p, & g_mutex: %p\n", g_mutex, &g_mutex);
+#endif
     assert(rc == 0);
     printf("static pthread_mutex_lock passed\n");
 
@@ -43,6 +66,16 @@ int main(int argc, char *argv[])
     assert(rc == EBUSY);
     printf("static pthread_mutex_trylock passed\n");
 
+    arch_time_in_timespec(&tp);
+    tp.tv_nsec += 20000000;
+    if (tp.tv_nsec >= POW10_9) {
+        tp.tv_nsec -= POW10_9;
+        tp.tv_sec += 1;
+    }
+    rc = pthread_mutex_timedlock(&g_mutex, &tp);
+    assert(rc == ETIMEDOUT);
+    printf("static pthread_mutex_timedlock passed\n");
+
     rc = pthread_mutex_unlock(&g_mutex);
     assert(rc == 0);
     printf("static pthread_mutex_unlock passed\n");
@@ -52,7 +85,6 @@ int main(int argc, char *argv[])
     printf("static pthread_mutex_destroy passed\n");
 
     /* normal initializer test */
-    printf("mutex: %p, & mutex: %p\n", mutex, &mutex);
     rc = pthread_mutex_init(&mutex, NULL);
     assert(rc == 0);
     printf("pthread_mutex_init passed\n");
@@ -67,11 +99,183 @@ int main(int argc, char *argv[])
 
     rc = pthread_mutex_unlock(&mutex);
     assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == EPERM);
+    assert(pthread_mutex_trylock(&mutex) == 0);
+    assert(pthread_mutex_unlock(&mutex) == 0);
     printf("pthread_mutex_unlock passed\n");
 
     rc = pthread_mutex_destroy(&mutex);
     assert(rc == 0);
     printf("pthread_mutex_destroy passed\n");
 
+    /* adaptive mutex test */
+    rc = pthread_mutexattr_init(&attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    assert(rc == 0);
+    rc = pthread_mutexattr_gettype(&attr, &type);
+    assert(rc == 0 && type == PTHREAD_MUTEX_ADAPTIVE_NP);
+    rc = pthread_mutex_init(&mutex, &attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_destroy(&attr);
+    assert(rc == 0);
+
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == EBUSY);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+    printf("adaptive pthread_mutex passed\n");
+
+    /* hand-off mutex test */
+    rc = pthread_mutexattr_init(&attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_HANDOFF_NP);
+    assert(rc == 0);
+    rc = pthread_mutexattr_gettype(&attr, &type);
+    assert(rc == 0 && type == PTHREAD_MUTEX_HANDOFF_NP);
+    rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_HANDOFF_NP + 1);
+    assert(rc == EINVAL);
+    rc = pthread_mutex_init(&mutex, &attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_destroy(&attr);
+    assert(rc == 0);
+
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == EBUSY);
+    rc = pthread_mutex_timedlock(&mutex, &tp);
+    assert(rc == ETIMEDOUT);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+    printf("hand-off pthread_mutex passed\n");
+
+    /* recursive mutex test */
+    rc = pthread_mutexattr_init(&attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    assert(rc == 0);
+    rc = pthread_mutex_init(&mutex, &attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_destroy(&attr);
+    assert(rc == 0);
+
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == EPERM);
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == EPERM);
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+    printf("recursive pthread_mutex passed\n");
+
+    /* error checking mutex test */
+    rc = pthread_mutexattr_init(&attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    assert(rc == 0);
+    rc = pthread_mutex_init(&mutex, &attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_destroy(&attr);
+    assert(rc == 0);
+
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == EDEADLK);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == EBUSY);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == EPERM);
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+    printf("errorcheck pthread_mutex passed\n");
+
+    /* process-shared mutex test */
+    rc = pthread_mutexattr_init(&attr);
+    assert(rc == 0);
+    rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED + 1);
+    assert(rc == EINVAL);
+    rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    assert(rc == 0);
+    rc = pthread_mutex_init(&mutex, &attr);
+    assert(pthread_mutexattr_destroy(&attr) == 0);
+#ifdef LIBPTHREAD_INLINE_MUTEX
+    assert(rc == 0);
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == EBUSY);
+    rc = pthread_mutex_timedlock(&mutex, &tp);
+    assert(rc == ETIMEDOUT);
+
+    /* the waiter blocks on the named semaphore until we unlock */
+    rc = pthread_create(&thread, NULL, lock_and_unlock, &mutex);
+    assert(rc == 0);
+    Sleep(50);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+    rc = pthread_join(thread, NULL);
+    assert(rc == 0);
+
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+#else
+    assert(rc == ENOTSUP);
+#endif
+    printf("process-shared pthread_mutex passed\n");
+
+    /* contention statistics test */
+    rc = pthread_mutex_init(&mutex, NULL);
+    assert(rc == 0);
+#ifdef LIBPTHREAD_LOCKSTAT
+    rc = pthread_mutex_setname_np(&mutex, "test_mutex");
+    assert(rc == 0);
+    rc = pthread_mutex_lock(&mutex);
+    assert(rc == 0);
+    rc = pthread_mutex_trylock(&mutex);
+    assert(rc == EBUSY);
+    rc = pthread_mutex_unlock(&mutex);
+    assert(rc == 0);
+
+    rc = pthread_lockstat_snapshot_np(stats, 8, &total);
+    assert(rc == 0 && total >= 1);
+    for (i = 0; i < total && i < 8; i++) {
+        if (stats[i].mutex == &mutex)
+            break;
+    }
+    assert(i < total && i < 8);
+    assert(strcmp(stats[i].name, "test_mutex") == 0);
+    assert(stats[i].acquisitions == 1 && stats[i].trylock_failures == 1);
+#else
+    rc = pthread_mutex_setname_np(&mutex, "test_mutex");
+    assert(rc == ENOTSUP);
+    rc = pthread_lockstat_snapshot_np(stats, 8, &total);
+    assert(rc == ENOTSUP && total == 0);
+#endif
+    rc = pthread_mutex_destroy(&mutex);
+    assert(rc == 0);
+    printf("pthread_lockstat_snapshot_np passed\n");
+
     return 0;
 }
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_THREADS    16
+#define TEST_LOOPS      10000
+
+pthread_phaser_t phaser;
+
+static volatile long arrivals;
+
+/* Worker i stays for a share of the phases, then leaves the pool. */
+static void *arrive_then_leave(void *arg)
+{
+    int i, loops = (int) (uintptr_t) arg;
+    long phase, last = -1;
+
+    for (i = 0; i < loops; i++) {
+        assert(pthread_phaser_arrive_and_wait(&phaser, &phase) >= 0);
+        /* never skips a phase, never arrives twice in one */
+        assert(last == -1 || phase == last + 1);
+        last = phase;
+        atomic_fetch_and_add(&arrivals, 1);
+    }
+
+    assert(pthread_phaser_arrive_and_deregister(&phaser, NULL) >= 0);
+    return NULL;
+}
+
+/* Arrive without waiting, as a pool worker handing in its last result. */
+static void *arrive_once(void *arg)
+{
+    assert(pthread_phaser_arrive(&phaser, NULL) >= 0);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    uintptr_t i;
+    long phase, total = 0;
+    pthread_t threads[TEST_THREADS];
+
+    assert(pthread_phaser_init(&phaser, NULL, 0x10000) == EINVAL);
+    assert(pthread_phaser_init(&phaser, NULL, 0) == 0);
+    printf("pthread_phaser_init passed\n");
+
+    assert(pthread_phaser_arrive(&phaser, NULL) == EINVAL);
+    phase = -1;
+    assert(pthread_phaser_arrive_and_wait(&phaser, &phase) == EINVAL);
+    assert(phase == -1);
+    assert(pthread_phaser_register(&phaser, 2, &phase) == 0);
+    assert(phase == 0);
+    assert(pthread_phaser_register(&phaser, 0xffff, NULL) == EAGAIN);
+    printf("pthread_phaser_register passed\n");
+
+    assert(pthread_phaser_arrive(&phaser, &phase) == 0);
+    assert(phase == 0);
+    assert(pthread_phaser_arrive(&phaser, &phase) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(phase == 0);
+    assert(pthread_phaser_await(&phaser, 0) == 0);
+    printf("pthread_phaser_arrive passed\n");
+
+    /* arrived in phase 1, leaves from phase 2 on */
+    assert(pthread_phaser_arrive(&phaser, &phase) == 0);
+    assert(phase == 1);
+    assert(pthread_phaser_deregister(&phaser, 1) == 0);
+    assert(pthread_phaser_deregister(&phaser, 1) == EINVAL);
+    assert(pthread_phaser_arrive(&phaser, &phase) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(pthread_phaser_arrive(&phaser, &phase) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(phase == 2);
+    /* arrived in phase 2, the phaser has advanced, so leaves from phase 3 */
+    assert(pthread_phaser_deregister(&phaser, 2) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(pthread_phaser_arrive(&phaser, NULL) == EINVAL);
+    /* registered in phase 3 but never arrived, so it must arrive to leave */
+    assert(pthread_phaser_register(&phaser, 1, &phase) == 0);
+    assert(phase == 3);
+    assert(pthread_phaser_arrive_and_deregister(&phaser, &phase) == PTHREAD_BARRIER_SERIAL_THREAD);
+    assert(phase == 3);
+    assert(pthread_phaser_arrive(&phaser, NULL) == EINVAL);
+    printf("pthread_phaser_deregister passed\n");
+
+    /* the main thread is a party while it grows the pool */
+    assert(pthread_phaser_register(&phaser, 1, NULL) == 0);
+    for (i = 0; i < TEST_THREADS; i++) {
+        assert(pthread_phaser_register(&phaser, 1, NULL) == 0);
+        assert(pthread_create(&threads[i], NULL, arrive_then_leave, (void *) (TEST_LOOPS * (i + 1) / TEST_THREADS)) == 0);
+        total += TEST_LOOPS * (i + 1) / TEST_THREADS;
+        assert(pthread_phaser_arrive_and_wait(&phaser, NULL) >= 0);
+    }
+    assert(pthread_phaser_arrive_and_deregister(&phaser, NULL) >= 0);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(arrivals == total);
+    assert(pthread_phaser_arrive(&phaser, NULL) == EINVAL);
+    printf("pthread_phaser elastic pool passed\n");
+
+    assert(pthread_phaser_destroy(&phaser) == 0);
+    printf("pthread_phaser_destroy passed\n");
+
+    /* destroyed as soon as the last worker has arrived, before it has left */
+    for (phase = 0; phase < TEST_LOOPS / 100; phase++) {
+        assert(pthread_phaser_init(&phaser, NULL, TEST_THREADS) == 0);
+        for (i = 0; i < TEST_THREADS; i++)
+            assert(pthread_create(&threads[i], NULL, arrive_once, NULL) == 0);
+        assert(pthread_phaser_await(&phaser, 0) == 0);
+        assert(pthread_phaser_destroy(&phaser) == 0);
+        for (i = 0; i < TEST_THREADS; i++)
+            assert(pthread_join(threads[i], NULL) == 0);
+    }
+    printf("pthread_phaser_destroy after pthread_phaser_await passed\n");
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_THREADS    8
+#define TEST_WRITES     1000
+
+pthread_rwlock_t g_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Readers hold the lock across a window the writer must never overlap. */
+static volatile long readers_inside, writer_inside, writes_done;
+
+static void *reader(void *arg)
+{
+    int j;
+
+    while (atomic_read(& writes_done) == 0) {
+        assert(pthread_rwlock_rdlock(&g_rwlock) == 0);
+        atomic_fetch_and_add(& readers_inside, 1);
+        for (j = 0; j < 64; j++) {
+            assert(atomic_read(& writer_inside) == 0);
+            cpu_relax();
+        }
+        atomic_fetch_and_add(& readers_inside, -1);
+        assert(pthread_rwlock_unlock(&g_rwlock) == 0);
+    }
+
+    return NULL;
+}
+
+/* Yield between writes so the bias comes back and every write revokes it. */
+static void *writer(void *arg)
+{
+    int i, j;
+
+    for (i = 0; i < TEST_WRITES; i++) {
+        assert(pthread_rwlock_wrlock(&g_rwlock) == 0);
+        atomic_set(& writer_inside, 1);
+        for (j = 0; j < 64; j++) {
+            assert(atomic_read(& readers_inside) == 0);
+            cpu_relax();
+        }
+        atomic_set(& writer_inside, 0);
+        assert(pthread_rwlock_unlock(&g_rwlock) == 0);
+
+        for (j = 0; j < 100; j++)
+            SwitchToThread();
+    }
+    atomic_set(& writes_done, 1);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    uintptr_t i;
+    int pshared;
+    pthread_t threads[TEST_THREADS];
+    pthread_rwlockattr_t attr;
+    pthread_rwlock_t rwlock;
+    struct timespec tp;
+
+    assert(pthread_rwlockattr_init(&attr) == 0);
+    assert(pthread_rwlockattr_getpshared(&attr, &pshared) == 0 && pshared == PTHREAD_PROCESS_PRIVATE);
+    assert(pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == ENOTSUP);
+    assert(pthread_rwlock_init(&rwlock, &attr) == 0);
+    assert(pthread_rwlockattr_destroy(&attr) == 0);
+    printf("pthread_rwlock_init passed\n");
+
+    /* the first read turns the bias on, the second takes the fast path */
+    assert(pthread_rwlock_rdlock(&rwlock) == 0);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_rdlock(&rwlock) == 0);
+    assert(pthread_rwlock_tryrdlock(&rwlock) == 0);
+    assert(pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_unlock(&rwlock) == EPERM);
+    printf("pthread_rwlock_rdlock passed\n");
+
+    assert(pthread_rwlock_wrlock(&rwlock) == 0);
+    assert(pthread_rwlock_tryrdlock(&rwlock) == EBUSY);
+    assert(pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+    arch_time_in_timespec(&tp);
+    tp.tv_nsec += 20000000;
+    if (tp.tv_nsec >= POW10_9) {
+        tp.tv_nsec -= POW10_9;
+        tp.tv_sec += 1;
+    }
+    assert(pthread_rwlock_timedrdlock(&rwlock, &tp) == ETIMEDOUT);
+    assert(pthread_rwlock_timedwrlock(&rwlock, &tp) == ETIMEDOUT);
+    assert(pthread_rwlock_destroy(&rwlock) == EBUSY);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    printf("pthread_rwlock_wrlock passed\n");
+
+    /* a writer after the bias came back must wait for the fast reader */
+    assert(pthread_rwlock_rdlock(&rwlock) == 0);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_rdlock(&rwlock) == 0);
+    assert(pthread_rwlock_timedwrlock(&rwlock, &tp) == ETIMEDOUT);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_trywrlock(&rwlock) == 0);
+    assert(pthread_rwlock_unlock(&rwlock) == 0);
+    assert(pthread_rwlock_destroy(&rwlock) == 0);
+    printf("pthread_rwlock revocation passed\n");
+
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, i == 0 ? writer : reader, NULL) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(readers_inside == 0 && writer_inside == 0);
+    assert(pthread_rwlock_destroy(&g_rwlock) == 0);
+    printf("pthread_rwlock revocation under readers passed\n");
+
+    return 0;
+}
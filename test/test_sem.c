@@ -17,6 +17,7 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,11 +26,65 @@
 
 #include "../src/misc.h"
 
+#define TEST_THREADS    8
+#define TEST_LOOPS      100000
+#define TEST_BATCH      10
+
+static sem_t items;
+static volatile long consumed;
+
+static void *produce(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOOPS; i++)
+        assert(sem_post(items) == 0);
+
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOOPS; i++) {
+        assert(sem_wait(items) == 0);
+        atomic_fetch_and_add(&consumed, 1);
+    }
+
+    return NULL;
+}
+
+static void *produce_batch(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOOPS; i += TEST_BATCH)
+        assert(sem_post_multiple_np(items, TEST_BATCH) == 0);
+
+    return NULL;
+}
+
+static void *consume_batch(void *arg)
+{
+    int got, left = TEST_LOOPS;
+
+    while (left > 0) {
+        assert(sem_wait_multiple_np(items, left < TEST_BATCH ? left : TEST_BATCH, &got) == 0);
+        assert(got >= 1 && got <= TEST_BATCH && got <= left);
+        left -= got;
+        atomic_fetch_and_add(&consumed, got);
+    }
+
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-    int rc;
-    sem_t sem;
+    int i, rc, value, got;
+    sem_t sem, sem2;
     struct timespec tp;
+    pthread_t threads[TEST_THREADS];
 
     rc = sem_init(&sem, PTHREAD_PROCESS_PRIVATE, 1);
     assert(rc == 0);
@@ -61,25 +116,94 @@ int main(int argc, char *argv[])
     assert(rc == 0);
     printf("sem_post passed\n");
 
+    rc = sem_getvalue(sem, &value);
+    assert(rc == 0 && value == 1);
+    printf("sem_getvalue passed\n");
+
+    rc = sem_post_multiple_np(sem, 4);
+    assert(rc == 0);
+    rc = sem_getvalue(sem, &value);
+    assert(rc == 0 && value == 5);
+    printf("sem_post_multiple_np passed\n");
+
+    rc = sem_wait_multiple_np(sem, 3, &got);
+    assert(rc == 0 && got == 3);
+    rc = sem_wait_multiple_np(sem, 3, &got);
+    assert(rc == 0 && got == 2);
+    rc = sem_getvalue(sem, &value);
+    assert(rc == 0 && value == 0);
+    printf("sem_wait_multiple_np passed\n");
+
     rc = sem_destroy(sem);
     assert(rc == 0);
     printf("sem_destroy passed\n");
 
+    assert(sem_init(&items, PTHREAD_PROCESS_PRIVATE, 0) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, i % 2 ? produce : consume, NULL) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(consumed == TEST_THREADS / 2 * TEST_LOOPS);
+    assert(sem_getvalue(items, &value) == 0 && value == 0);
+    assert(sem_destroy(items) == 0);
+    printf("sem contention passed\n");
+
+    consumed = 0;
+    assert(sem_init(&items, PTHREAD_PROCESS_PRIVATE, 0) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, i % 2 ? produce_batch : consume_batch, NULL) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(consumed == TEST_THREADS / 2 * TEST_LOOPS);
+    assert(sem_getvalue(items, &value) == 0 && value == 0);
+    assert(sem_destroy(items) == 0);
+    printf("sem batch contention passed\n");
+
     sem = sem_open("MySem", 0, 0, 1);
-    assert(sem == NULL);
+    assert(sem == NULL && errno == ENOENT);
     printf("sem_open passed\n");
 
     sem = sem_open("MySem", O_CREAT, 0, 1);
     assert(sem != NULL);
     printf("sem_open with create passed\n");
 
+    sem2 = sem_open("MySem", O_CREAT | O_EXCL, 0, 1);
+    assert(sem2 == NULL && errno == EEXIST);
+    sem2 = sem_open("MySem", 0, 0, 0);
+    assert(sem2 != NULL);
+    assert(sem_wait(sem2) == 0);
+    assert(sem_post_multiple_np(sem, 2) == 0);
+    assert(sem_getvalue(sem2, &value) == 0 && value == 2);
+    assert(sem_close(sem2) == 0);
+    printf("sem_open of an existing one passed\n");
+
     rc = sem_close(sem);
     assert(rc == 0);
     printf("sem_close passed\n");
 
+    sem = sem_open("MySem", 0, 0, 0);
+    assert(sem != NULL);
+    assert(sem_getvalue(sem, &value) == 0 && value == 2);
+    printf("sem_open after sem_close passed\n");
+
     rc = sem_unlink("MySem");
     assert(rc == 0);
+    rc = sem_unlink("MySem");
+    assert(rc == -1 && errno == ENOENT);
+    sem2 = sem_open("MySem", 0, 0, 0);
+    assert(sem2 == NULL && errno == ENOENT);
     printf("sem_unlink passed\n");
 
+    sem2 = sem_open("MySem", O_CREAT | O_EXCL, 0, 0);
+    assert(sem2 != NULL);
+    assert(sem_getvalue(sem2, &value) == 0 && value == 0);
+    assert(sem_post(sem) == 0);
+    assert(sem_getvalue(sem, &value) == 0 && value == 3);
+    assert(sem_getvalue(sem2, &value) == 0 && value == 0);
+    assert(sem_close(sem) == 0);
+    assert(sem_close(sem2) == 0);
+    assert(sem_unlink("MySem") == 0);
+    printf("sem_open after sem_unlink passed\n");
+
     return 0;
 }
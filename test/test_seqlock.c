@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_THREADS    8
+#define TEST_WRITERS    2
+#define TEST_LOOPS      100000
+#define TEST_WORDS      16
+
+pthread_seqlock_t lock = PTHREAD_SEQLOCK_INITIALIZER;
+
+/*
+ * A record too wide to be loaded at once, every word of which a write sets
+ * to the same new value, one word at a time, so unlocked reads see it torn.
+ */
+static volatile long record[TEST_WORDS];
+static volatile long retries, torn;
+static volatile long begun, written;
+
+static void *writer(void *arg)
+{
+    int i, j;
+    long v;
+
+    for (i = 0; i < TEST_LOOPS / 100; i++) {
+        assert(pthread_seqlock_write_lock(&lock) == 0);
+        v = record[0] + 1;
+        for (j = 0; j < TEST_WORDS; j++) {
+            record[j] = v;
+            cpu_relax();
+        }
+        assert(pthread_seqlock_write_unlock(&lock) == 0);
+    }
+
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    int i, j, same;
+    long stamp, last = 0, copy[TEST_WORDS];
+
+    for (i = 0; i < TEST_LOOPS; i++) {
+        while (1) {
+            stamp = pthread_seqlock_read_begin(&lock);
+            for (j = 0; j < TEST_WORDS; j++)
+                copy[j] = record[j];
+            for (same = 1, j = 1; j < TEST_WORDS; j++)
+                same &= copy[j] == copy[0];
+            if (pthread_seqlock_read_validate(&lock, stamp))
+                break;
+            atomic_fetch_and_add(&retries, 1);
+            if (!same)
+                atomic_fetch_and_add(&torn, 1);
+        }
+        /* a validated copy is whole, and never older than the last one */
+        assert(same);
+        assert(copy[0] >= last);
+        last = copy[0];
+    }
+
+    return NULL;
+}
+
+/* Begin a read, let the main thread write, then validate it. */
+static void *read_across_write(void *arg)
+{
+    long stamp = pthread_seqlock_read_begin(&lock);
+
+    atomic_set(&begun, 1);
+    while (!atomic_read(&written))
+        cpu_relax();
+    assert(!pthread_seqlock_read_validate(&lock, stamp));
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    uintptr_t i;
+    long stamp;
+    pthread_t threads[TEST_THREADS];
+
+    assert(pthread_seqlock_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0);
+    printf("pthread_seqlock_init passed\n");
+
+    stamp = pthread_seqlock_read_begin(&lock);
+    assert((stamp & 1) == 0);
+    assert(pthread_seqlock_read_validate(&lock, stamp));
+    printf("pthread_seqlock_read_begin passed\n");
+
+    assert(pthread_seqlock_write_lock(&lock) == 0);
+    assert(!pthread_seqlock_read_validate(&lock, stamp));
+    assert(pthread_seqlock_write_unlock(&lock) == 0);
+    assert(!pthread_seqlock_read_validate(&lock, stamp));
+    assert(pthread_seqlock_read_begin(&lock) == stamp + 2);
+    printf("pthread_seqlock_read_validate passed\n");
+
+    assert(pthread_create(&threads[0], NULL, read_across_write, NULL) == 0);
+    while (!atomic_read(&begun))
+        cpu_relax();
+    assert(pthread_seqlock_write_lock(&lock) == 0);
+    assert(pthread_seqlock_write_unlock(&lock) == 0);
+    atomic_set(&written, 1);
+    assert(pthread_join(threads[0], NULL) == 0);
+    printf("pthread_seqlock_read_validate across a write passed\n");
+
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_create(&threads[i], NULL, i < TEST_WRITERS ? writer : reader, NULL) == 0);
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    for (i = 0; i < TEST_WORDS; i++)
+        assert(record[i] == TEST_WRITERS * (TEST_LOOPS / 100));
+    printf("pthread_seqlock contention passed, %ld retries, %ld torn reads rejected\n", retries, torn);
+
+    assert(pthread_seqlock_destroy(&lock) == 0);
+    printf("pthread_seqlock_destroy passed\n");
+
+    return 0;
+}
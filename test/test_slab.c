@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011, Dongsheng Song <songdongsheng@live.cn>
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <winsock2.h>
+#include <pthread.h>
+
+#include "../src/misc.h"
+
+#define TEST_OBJECTS    1000
+
+pthread_barrier_t barriers[TEST_OBJECTS];
+
+int main(int argc, char *argv[])
+{
+    int i;
+    pthread_memstat_np_t st, st2;
+
+    assert(pthread_memstat_np(NULL) == EINVAL);
+    assert(pthread_memstat_np(&st) == 0);
+    printf("pthread_memstat_np passed\n");
+
+    for (i = 0; i < TEST_OBJECTS; i++) {
+        assert(pthread_barrier_init(&barriers[i], NULL, 1) == 0);
+        /* every object starts on its own cache line */
+        assert(((uintptr_t) barriers[i] & 63) == 0);
+    }
+
+    assert(pthread_memstat_np(&st2) == 0);
+    assert(st2.in_use >= st.in_use + TEST_OBJECTS * 64);
+    printf("slab allocation passed\n");
+
+    for (i = 0; i < TEST_OBJECTS; i++)
+        assert(pthread_barrier_destroy(&barriers[i]) == 0);
+
+    assert(pthread_memstat_np(&st2) == 0);
+    assert(st2.in_use == st.in_use);
+    printf("slab release passed\n");
+
+    return 0;
+}
@@ -136,6 +136,90 @@ void test_sem()
         (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 1000.0));
 }
 
+/* An uncontended handoff through a private semaphore, or a named one. */
+void test_sem_post_wait(const char *name)
+{
+    int i;
+    sem_t sem;
+    struct timespec tp, tp2;
+
+    if (name == NULL)
+        sem_init(&sem, PTHREAD_PROCESS_PRIVATE, 0);
+    else
+        sem = sem_open(name, O_CREAT, 0, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    for(i = 0; i < TEST_TIMES; i++) {
+        sem_post(sem);
+        sem_wait(sem);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+    if (name == NULL) {
+        sem_destroy(sem);
+    } else {
+        sem_close(sem);
+        sem_unlink(name);
+    }
+
+    fprintf(stdout, "              %7s sem_post/sem_wait: %7.3lf us\n",
+        name == NULL ? "private" : "named",
+        (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 1000.0));
+}
+
+#define BATCH_CONSUMERS 4
+#define BATCH_SIZE      16
+
+static sem_t batch_sem;
+
+/* Drain an equal share of the units posted, as many at a time as given. */
+static void *batch_consumer(void *arg)
+{
+    int got;
+    long left = TEST_TIMES / BATCH_CONSUMERS;
+
+    while (left > 0) {
+        sem_wait_multiple_np(batch_sem, left < BATCH_SIZE ? (int) left : BATCH_SIZE, &got);
+        left -= got;
+    }
+
+    return NULL;
+}
+
+/*
+ * Throughput of handing units to blocked consumers, posted one at a time
+ * or a batch at a time with sem_post_multiple_np().
+ */
+void test_sem_post_multiple(int batched, const char *name)
+{
+    int i, j;
+    pthread_t threads[BATCH_CONSUMERS];
+    struct timespec tp, tp2;
+
+    sem_init(&batch_sem, PTHREAD_PROCESS_PRIVATE, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    for(i = 0; i < BATCH_CONSUMERS; i++)
+        pthread_create(&threads[i], NULL, batch_consumer, NULL);
+    for(i = 0; i < TEST_TIMES / BATCH_CONSUMERS * BATCH_CONSUMERS; i += BATCH_SIZE) {
+        if (batched) {
+            sem_post_multiple_np(batch_sem, BATCH_SIZE);
+        } else {
+            for(j = 0; j < BATCH_SIZE; j++)
+                sem_post(batch_sem);
+        }
+    }
+    for(i = 0; i < BATCH_CONSUMERS; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+    sem_destroy(batch_sem);
+
+    fprintf(stdout, "%7s %d consumers sem_post x %d: %7.3lf us\n",
+        name, BATCH_CONSUMERS, BATCH_SIZE,
+        (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 1000.0));
+}
+
 void test_lps()
 {
     int i;
@@ -174,6 +258,75 @@ void test_spin()
         (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 100000.0));
 }
 
+#define SPIN_MAX_THREADS    64
+
+static pthread_spinlock_t contended_spin = PTHREAD_SPINLOCK_INITIALIZER;
+static pthread_mcs_lock_t contended_mcs = PTHREAD_MCS_LOCK_INITIALIZER;
+static volatile long contended_spin_counter;
+
+static void *spin_worker(void *arg)
+{
+    int i;
+
+    for(i = TEST_TIMES / 10; i > 0; i--) {
+        pthread_spin_lock(&contended_spin);
+        contended_spin_counter++;
+        pthread_spin_unlock(&contended_spin);
+    }
+
+    return NULL;
+}
+
+static void *mcs_worker(void *arg)
+{
+    int i;
+
+    for(i = TEST_TIMES / 10; i > 0; i--) {
+        pthread_mcs_lock(&contended_mcs);
+        contended_spin_counter++;
+        pthread_mcs_unlock(&contended_mcs);
+    }
+
+    return NULL;
+}
+
+/*
+ * Cost per acquisition of a spin lock hammered by 1 to N threads. With
+ * proportional backoff the handoff cost should stay flat as waiters are
+ * added, rather than grow with the number of caches polling the lock.
+ * The MCS lock spins locally and should scale best on many cores.
+ */
+void test_spin_contended(void *(*worker)(void *), const char *name)
+{
+    int i, n, ncpu = get_ncpu();
+    pthread_t threads[SPIN_MAX_THREADS];
+    struct timespec tp, tp2;
+
+    if (ncpu > SPIN_MAX_THREADS)
+        ncpu = SPIN_MAX_THREADS;
+
+    for(n = 1; ; n = n * 2 < ncpu ? n * 2 : ncpu) {
+        contended_spin_counter = 0;
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        for(i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, worker, NULL);
+        for(i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+        if (contended_spin_counter != (long) n * (TEST_TIMES / 10)) {
+            fprintf(stderr, "contended pthread_%s lost updates: %ld\n", name, contended_spin_counter);
+            exit(1);
+        }
+
+        fprintf(stdout, "%2d threads pthread_%s_lock contended: %7.3lf us\n", n, name,
+            (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (n * (TEST_TIMES / 10) * 1000.0));
+
+        if (n == ncpu)
+            break;
+    }
+}
+
 #ifdef _MSC_VER
 void spin_count(int count)
 #else
@@ -235,6 +388,325 @@ void test_mutex()
         (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 100000.0));
 }
 
+void test_mutex_timedlock()
+{
+    int i;
+    long rc;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct timespec tp, tp2, deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 3600;
+
+    rc = pthread_mutex_timedlock(&mutex, &deadline);
+    if (rc != 0) {
+        fprintf(stderr, "pthread_mutex_timedlock failed: %ld\n", rc);
+        exit(1);
+    }
+
+    rc = pthread_mutex_unlock(&mutex);
+    if (rc != 0) {
+        fprintf(stderr, "pthread_mutex_unlock failed: %ld\n", rc);
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    for(i = TEST_TIMES * 100; i > 0; i--) {
+        pthread_mutex_timedlock(&mutex, &deadline);
+        pthread_mutex_unlock(&mutex);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+    pthread_mutex_destroy(&mutex);
+
+    fprintf(stdout, "pthread_mutex_timedlock/pthread_mutex_unlock: %7.3lf us\n",
+        (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (TEST_TIMES * 100000.0));
+}
+
+#define CONTENDED_THREADS   4
+
+static pthread_mutex_t contended_mutex;
+static volatile long contended_counter;
+
+static void *contended_worker(void *arg)
+{
+    int i;
+
+    for(i = TEST_TIMES; i > 0; i--) {
+        pthread_mutex_lock(&contended_mutex);
+        contended_counter++;
+        pthread_mutex_unlock(&contended_mutex);
+    }
+
+    return NULL;
+}
+
+static __int64 kernel_time_in_100ns()
+{
+    FILETIME creation, exited, kernel, user;
+
+    GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user);
+    return ((__int64) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+}
+
+/*
+ * Throughput of a mutex hammered by several threads, with the kernel time
+ * spent, which is where redundant wakeups and futile sleeps show up.
+ */
+void test_mutex_contended(int type, const char *name)
+{
+    int i;
+    long rc;
+    __int64 kt, kt2;
+    pthread_t threads[CONTENDED_THREADS];
+    pthread_mutexattr_t attr;
+    struct timespec tp, tp2;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, type);
+    rc = pthread_mutex_init(&contended_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        fprintf(stderr, "pthread_mutex_init failed: %ld\n", rc);
+        exit(1);
+    }
+    contended_counter = 0;
+
+    kt = kernel_time_in_100ns();
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    for(i = 0; i < CONTENDED_THREADS; i++) {
+        rc = pthread_create(&threads[i], NULL, contended_worker, NULL);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create failed: %ld\n", rc);
+            exit(1);
+        }
+    }
+    for(i = 0; i < CONTENDED_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &tp2);
+    kt2 = kernel_time_in_100ns();
+
+    if (contended_counter != (long) CONTENDED_THREADS * TEST_TIMES) {
+        fprintf(stderr, "contended pthread_mutex lost updates: %ld\n", contended_counter);
+        exit(1);
+    }
+
+    pthread_mutex_destroy(&contended_mutex);
+
+    fprintf(stdout, "%7s %d threads pthread_mutex contended: %7.3lf us, kernel %7.3lf ms\n",
+        name, CONTENDED_THREADS,
+        (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (CONTENDED_THREADS * TEST_TIMES * 1000.0),
+        (kt2 - kt) / 10000.0);
+}
+
+#define BROADCAST_WAITERS   32
+#define BROADCAST_ROUNDS    1000
+
+static pthread_cond_t broadcast_cond;
+static volatile long broadcast_round, broadcast_waiting;
+
+static void *broadcast_worker(void *arg)
+{
+    long round;
+
+    pthread_mutex_lock(&contended_mutex);
+    for(round = 1; round <= BROADCAST_ROUNDS; round++) {
+        broadcast_waiting++;
+        while (broadcast_round < round)
+            pthread_cond_wait(&broadcast_cond, &contended_mutex);
+    }
+    pthread_mutex_unlock(&contended_mutex);
+
+    return NULL;
+}
+
+/*
+ * Broadcast to many waiters blocked on one mutex. With wait morphing the
+ * waiters are woken one per unlock instead of all at once.
+ */
+void test_cond_broadcast()
+{
+    int i;
+    long round;
+    __int64 kt, kt2;
+    pthread_t threads[BROADCAST_WAITERS];
+    struct timespec tp, tp2;
+
+    pthread_mutex_init(&contended_mutex, NULL);
+    pthread_cond_init(&broadcast_cond, NULL);
+    broadcast_round = broadcast_waiting = 0;
+
+    for(i = 0; i < BROADCAST_WAITERS; i++)
+        pthread_create(&threads[i], NULL, broadcast_worker, NULL);
+
+    kt = kernel_time_in_100ns();
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    for(round = 1; round <= BROADCAST_ROUNDS; round++) {
+        /* wait until every thread is waiting for this round */
+        while (1) {
+            pthread_mutex_lock(&contended_mutex);
+            if (broadcast_waiting == round * BROADCAST_WAITERS)
+                break;
+            pthread_mutex_unlock(&contended_mutex);
+            SwitchToThread();
+        }
+        broadcast_round = round;
+        pthread_cond_broadcast(&broadcast_cond);
+        pthread_mutex_unlock(&contended_mutex);
+    }
+    for(i = 0; i < BROADCAST_WAITERS; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &tp2);
+    kt2 = kernel_time_in_100ns();
+
+    pthread_cond_destroy(&broadcast_cond);
+    pthread_mutex_destroy(&contended_mutex);
+
+    fprintf(stdout, "%d waiters pthread_cond_broadcast: %7.3lf us, kernel %7.3lf ms\n",
+        BROADCAST_WAITERS,
+        (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (BROADCAST_ROUNDS * 1000.0),
+        (kt2 - kt) / 10000.0);
+}
+
+#define RWLOCK_MAX_READERS  64
+
+static pthread_rwlock_t reader_rwlock;
+static pthread_spin_rwlock_t reader_spin_rwlock = PTHREAD_SPIN_RWLOCK_INITIALIZER;
+static pthread_seqlock_t reader_seqlock = PTHREAD_SEQLOCK_INITIALIZER;
+static volatile long reader_data;
+
+static void *reader_worker(void *arg)
+{
+    int i;
+
+    for(i = TEST_TIMES; i > 0; i--) {
+        pthread_rwlock_rdlock(&reader_rwlock);
+        pthread_rwlock_unlock(&reader_rwlock);
+    }
+
+    return NULL;
+}
+
+static void *spin_reader_worker(void *arg)
+{
+    int i;
+
+    for(i = TEST_TIMES; i > 0; i--) {
+        pthread_spin_rwlock_reader_lock(&reader_spin_rwlock);
+        pthread_spin_rwlock_reader_unlock(&reader_spin_rwlock);
+    }
+
+    return NULL;
+}
+
+static void *seqlock_reader_worker(void *arg)
+{
+    int i;
+    long stamp;
+
+    for(i = TEST_TIMES; i > 0; i--) {
+        do {
+            stamp = pthread_seqlock_read_begin(&reader_seqlock);
+            (void) reader_data;
+        } while (!pthread_seqlock_read_validate(&reader_seqlock, stamp));
+    }
+
+    return NULL;
+}
+
+/*
+ * Read-lock throughput from 1 to N threads. Readers that only touch their
+ * own slot, or no store at all as with the sequence lock, should keep the
+ * per-operation cost flat as threads are added, readers that share one
+ * counter at least should not queue on each other.
+ */
+void test_rwlock_readers(void *(*worker)(void *), const char *name)
+{
+    int i, n, ncpu = get_ncpu();
+    pthread_t threads[RWLOCK_MAX_READERS];
+    struct timespec tp, tp2;
+    double ns;
+
+    if (ncpu > RWLOCK_MAX_READERS)
+        ncpu = RWLOCK_MAX_READERS;
+
+    pthread_rwlock_init(&reader_rwlock, NULL);
+
+    for(n = 1; ; n = n * 2 < ncpu ? n * 2 : ncpu) {
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        for(i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, worker, NULL);
+        for(i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+        ns = (double) (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9);
+        fprintf(stdout, "%2d readers %s: %7.3lf us, %7.3lf Mops/s\n",
+            n, name, ns / (TEST_TIMES * 1000.0), n * TEST_TIMES * 1000.0 / ns);
+
+        if (n == ncpu)
+            break;
+    }
+
+    pthread_rwlock_destroy(&reader_rwlock);
+}
+
+#define BARRIER_MAX_THREADS 128
+#define BARRIER_ROUNDS      10000
+
+static pthread_barrier_t speed_barrier;
+
+static void *barrier_worker(void *arg)
+{
+    int i;
+
+    for(i = BARRIER_ROUNDS; i > 0; i--)
+        pthread_barrier_wait(&speed_barrier);
+
+    return NULL;
+}
+
+/*
+ * Barrier latency, from one arrival to all departures, by thread count.
+ * The flat counter costs one cache line transfer per arrival, which the
+ * tree spreads over lines shared by a few neighbouring processors each.
+ */
+void test_barrier(int policy, int type, const char *name)
+{
+    int i, n, ncpu = get_ncpu();
+    pthread_t threads[BARRIER_MAX_THREADS];
+    pthread_barrierattr_t attr;
+    struct timespec tp, tp2;
+
+    if (ncpu > BARRIER_MAX_THREADS)
+        ncpu = BARRIER_MAX_THREADS;
+
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setwaitpolicy_np(&attr, policy);
+    pthread_barrierattr_settype_np(&attr, type);
+
+    for(n = 1; ; n = n * 2 < ncpu ? n * 2 : ncpu) {
+        pthread_barrier_init(&speed_barrier, &attr, n);
+
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        for(i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, barrier_worker, NULL);
+        for(i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &tp2);
+
+        pthread_barrier_destroy(&speed_barrier);
+
+        fprintf(stdout, "%3d threads %12s pthread_barrier_wait: %7.3lf us\n", n, name,
+            (tp2.tv_nsec - tp.tv_nsec + (tp2.tv_sec - tp.tv_sec) * POW10_9) / (BARRIER_ROUNDS * 1000.0));
+
+        if (n == ncpu)
+            break;
+    }
+
+    pthread_barrierattr_destroy(&attr);
+}
+
 #ifndef _MSC_VER
 __attribute__ ((noinline))
 #endif
@@ -277,10 +749,26 @@ int main(int argc, char *argv[])
 
     test_mono();
     test_mutex();
+    test_mutex_timedlock();
+    test_mutex_contended(PTHREAD_MUTEX_NORMAL, "normal");
+    test_mutex_contended(PTHREAD_MUTEX_HANDOFF_NP, "handoff");
+    test_cond_broadcast();
+    test_rwlock_readers(reader_worker, "pthread_rwlock");
+    test_rwlock_readers(spin_reader_worker, "pthread_spin_rwlock");
+    test_rwlock_readers(seqlock_reader_worker, "pthread_seqlock");
+    test_barrier(PTHREAD_WAIT_POLICY_PASSIVE_NP, PTHREAD_BARRIER_FLAT_NP, "passive");
+    test_barrier(PTHREAD_WAIT_POLICY_DEFAULT_NP, PTHREAD_BARRIER_FLAT_NP, "flat");
+    test_barrier(PTHREAD_WAIT_POLICY_DEFAULT_NP, PTHREAD_BARRIER_TREE_NP, "tree");
     test_spin_count();
     test_spin();
+    test_spin_contended(spin_worker, "spin");
+    test_spin_contended(mcs_worker, "mcs");
     test_lps();
     test_sem();
+    test_sem_post_wait(NULL);
+    test_sem_post_wait("test_speed");
+    test_sem_post_multiple(0, "single");
+    test_sem_post_multiple(1, "batched");
     test_evt();
     test_tid();
     test_cs();
@@ -25,10 +25,29 @@
 
 #include "../src/misc.h"
 
+#define TEST_MAX_THREADS    64
+
 pthread_spinlock_t lock;
 
+/* Each waiter logs the place it got in, which must be its place in the queue. */
+static uintptr_t queue_order[TEST_MAX_THREADS];
+static long queue_len;
+
+static void *queue_behind(void *arg)
+{
+    assert(pthread_spin_lock(&lock) == 0);
+    queue_order[queue_len++] = (uintptr_t) arg;
+    assert(pthread_spin_unlock(&lock) == 0);
+
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
+    uintptr_t i, n;
+    long ticket;
+    pthread_t threads[TEST_MAX_THREADS];
+
     assert(pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0);
     printf("pthread_spin_init passed\n");
 
@@ -41,6 +60,30 @@ int main(int argc, char *argv[])
     assert(pthread_spin_unlock(&lock) == 0);
     printf("pthread_spin_unlock passed\n");
 
+    /*
+     * Queue more waiters than processors, one ticket at a time, so the ones
+     * far back back off the longest and some spin preempted: every handoff
+     * must still complete, in ticket order.
+     */
+    n = 4 * get_ncpu();
+    if (n > TEST_MAX_THREADS)
+        n = TEST_MAX_THREADS;
+    assert(pthread_spin_lock(&lock) == 0);
+    ticket = lock.ticket;
+    for (i = 0; i < n; i++) {
+        assert(pthread_create(&threads[i], NULL, queue_behind, (void *) i) == 0);
+        while (atomic_read(& lock.ticket) == ticket)
+            cpu_relax();
+        ticket++;
+    }
+    assert(pthread_spin_unlock(&lock) == 0);
+    for (i = 0; i < n; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(queue_len == n && lock.owner == lock.ticket);
+    for (i = 0; i < n; i++)
+        assert(queue_order[i] == i);
+    printf("pthread_spin_lock backoff passed\n");
+
     assert(pthread_spin_destroy(&lock) == 0);
     printf("pthread_spin_destroy passed\n");
 
@@ -19,16 +19,88 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <winsock2.h>
 #include <pthread.h>
 
 #include "../src/misc.h"
 
+#define TEST_THREADS    8
+#define TEST_LOOPS      100000
+
 pthread_spin_rwlock_t lock = PTHREAD_SPIN_RWLOCK_INITIALIZER;
 
+/* Threads log the order they get in, writers as 'W' and readers as 'R'. */
+static const char queue_roles[] = "WRWRW";
+static char queue_order[sizeof(queue_roles)];
+static volatile long queue_len;
+
+static void *queue_behind(void *arg)
+{
+    uintptr_t role = (uintptr_t) arg;
+
+    if (role == 'W') {
+        assert(pthread_spin_rwlock_writer_lock(&lock) == 0);
+        queue_order[atomic_fetch_and_add(& queue_len, 1)] = 'W';
+        assert(pthread_spin_rwlock_writer_unlock(&lock) == 0);
+    } else {
+        assert(pthread_spin_rwlock_reader_lock(&lock) == 0);
+        queue_order[atomic_fetch_and_add(& queue_len, 1)] = 'R';
+        assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+    }
+
+    return NULL;
+}
+
+/* Fills keep the two halves equal, readers must never see them differ. */
+static volatile long half1, half2;
+
+static void *reader(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOOPS; i++) {
+        assert(pthread_spin_rwlock_reader_lock(&lock) == 0);
+        assert(half1 == half2);
+        assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+    }
+
+    return NULL;
+}
+
+/* Read, and only on a miss upgrade and fill, as a cache would. */
+static volatile long cache_fills;
+
+static void *lookup_or_fill(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOOPS; i++) {
+        assert(pthread_spin_rwlock_upgradable_lock(&lock) == 0);
+        if (half1 == half2 && i % 10 == 0) {
+            assert(pthread_spin_rwlock_upgrade(&lock) == 0);
+            half1++;
+            cache_fills++;
+            half2++;
+            assert(pthread_spin_rwlock_downgrade(&lock) == 0);
+            assert(half1 == half2);
+            assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+        } else {
+            assert(half1 == half2);
+            assert(pthread_spin_rwlock_upgradable_unlock(&lock) == 0);
+        }
+    }
+
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
+    uintptr_t i;
+    long ticket;
+    pthread_t threads[TEST_THREADS];
+
     assert(pthread_spin_rwlock_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0);
     printf("pthread_spin_rwlock_init passed\n");
 
@@ -48,6 +120,52 @@ int main(int argc, char *argv[])
     assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
     printf("pthread_spin_rwlock_reader_unlock passed\n");
 
+    /*
+     * While a writer holds the lock, each thread takes its ticket before the
+     * next one starts: writers go in ticket order and a reader that arrives
+     * behind a queued writer waits for it.
+     */
+    assert(pthread_spin_rwlock_writer_lock(&lock) == 0);
+    ticket = lock.ticket;
+    for (i = 0; i < sizeof(queue_roles) - 1; i++) {
+        assert(pthread_create(&threads[i], NULL, queue_behind, (void *) (uintptr_t) queue_roles[i]) == 0);
+        while (atomic_read(& lock.ticket) == ticket)
+            cpu_relax();
+        ticket++;
+    }
+    assert(pthread_spin_rwlock_writer_unlock(&lock) == 0);
+    for (i = 0; i < sizeof(queue_roles) - 1; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(queue_len == sizeof(queue_roles) - 1);
+    assert(memcmp(queue_order, queue_roles, sizeof(queue_roles) - 1) == 0);
+    assert(lock.owner == lock.ticket && lock.readers == 0);
+    printf("pthread_spin_rwlock queue order passed\n");
+
+    /* upgradable coexists with plain readers */
+    assert(pthread_spin_rwlock_upgradable_lock(&lock) == 0);
+    assert(pthread_spin_rwlock_reader_lock(&lock) == 0);
+    assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+    assert(pthread_spin_rwlock_upgrade(&lock) == 0);
+    assert(pthread_spin_rwlock_downgrade(&lock) == 0);
+    assert(pthread_spin_rwlock_reader_lock(&lock) == 0);
+    assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+    assert(pthread_spin_rwlock_reader_unlock(&lock) == 0);
+    assert(pthread_spin_rwlock_upgradable_lock(&lock) == 0);
+    assert(pthread_spin_rwlock_upgradable_unlock(&lock) == 0);
+    printf("pthread_spin_rwlock_upgrade passed\n");
+
+    half1 = half2 = 0;
+    for (i = 0; i < TEST_THREADS; i++) {
+        if (i % 2 == 0)
+            assert(pthread_create(&threads[i], NULL, lookup_or_fill, NULL) == 0);
+        else
+            assert(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+    }
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+    assert(half1 == cache_fills && half1 == half2);
+    printf("pthread_spin_rwlock upgrade contention passed\n");
+
     assert(pthread_spin_rwlock_destroy(&lock) == 0);
     printf("pthread_spin_rwlock_destroy passed\n");
 